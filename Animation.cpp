@@ -0,0 +1,626 @@
+#include "Animation.hpp"
+
+#include <algorithm>
+
+enum
+{
+    // the cursor is moved forward this many segments before falling back to a binary search
+    CURSOR_MAX_STEPS = 4,
+
+    VEC3_QUANTIZATION_MAX = 65535,
+    QUAT_QUANTIZATION_MAX = 32767
+};
+
+// the components other than the largest one are in this range
+static const float QUAT_COMPONENT_MAX = 0.70710678f;
+
+static PackedVec3 packVec3(vec3 v, vec3 min, vec3 extent)
+{
+    PackedVec3 packed;
+
+    for(int i = 0; i < 3; ++i)
+    {
+        const float normalized = extent[i] > 0.f ? ::min(::max((v[i] - min[i]) / extent[i], 0.f), 1.f) : 0.f;
+        packed.v[i] = normalized * VEC3_QUANTIZATION_MAX + 0.5f;
+    }
+
+    return packed;
+}
+
+static vec3 unpackVec3(PackedVec3 packed, vec3 min, vec3 extent)
+{
+    const vec3 normalized = vec3(packed.v[0], packed.v[1], packed.v[2]) * (1.f / VEC3_QUANTIZATION_MAX);
+    return min + extent * normalized;
+}
+
+static PackedQuat packQuat(quat q)
+{
+    q = normalize(q);
+    const float components[4] = {q.x, q.y, q.z, q.w};
+
+    int largest = 0;
+    for(int i = 1; i < 4; ++i)
+    {
+        if(fabsf(components[i]) > fabsf(components[largest]))
+            largest = i;
+    }
+
+    // q and -q are the same rotation, the dropped component is always positive
+    const float sign = components[largest] < 0.f ? -1.f : 1.f;
+
+    PackedQuat packed;
+    int idx = 0;
+
+    for(int i = 0; i < 4; ++i)
+    {
+        if(i == largest)
+            continue;
+
+        const float normalized = min(max(sign * components[i] / QUAT_COMPONENT_MAX * 0.5f + 0.5f, 0.f), 1.f);
+        const unsigned bits = normalized * QUAT_QUANTIZATION_MAX + 0.5f;
+        packed.v[idx] = bits << 1;
+        ++idx;
+    }
+
+    packed.v[0] |= largest & 1;
+    packed.v[1] |= largest >> 1;
+    return packed;
+}
+
+static quat unpackQuat(PackedQuat packed)
+{
+    const int largest = (packed.v[0] & 1) | ((packed.v[1] & 1) << 1);
+    float components[4];
+    float sum = 0.f;
+    int idx = 0;
+
+    for(int i = 0; i < 4; ++i)
+    {
+        if(i == largest)
+            continue;
+
+        const float normalized = (packed.v[idx] >> 1) * (1.f / QUAT_QUANTIZATION_MAX);
+        components[i] = (normalized * 2.f - 1.f) * QUAT_COMPONENT_MAX;
+        sum += components[i] * components[i];
+        ++idx;
+    }
+
+    components[largest] = sqrtf(max(1.f - sum, 0.f));
+    return {components[0], components[1], components[2], components[3]};
+}
+
+static vec3 lerp(vec3 v1, vec3 v2, float a)
+{
+    return v1 + a * (v2 - v1);
+}
+
+static float getError(vec3 v1, vec3 v2)
+{
+    const vec3 d = v2 - v1;
+    return max(fabsf(d.x), max(fabsf(d.y), fabsf(d.z)));
+}
+
+static float getError(quat q1, quat q2)
+{
+    const float sign = dot(q1, q2) < 0.f ? -1.f : 1.f;
+    return max(max(fabsf(sign * q2.x - q1.x), fabsf(sign * q2.y - q1.y)),
+               max(fabsf(sign * q2.z - q1.z), fabsf(sign * q2.w - q1.w)));
+}
+
+// returns the segment [idx, idx + 1] containing time, timestamps.size() must be > 1
+static int findKey(const std::vector<float>& timestamps, float time, int cursor)
+{
+    const int lastSegment = timestamps.size() - 2;
+
+    if(cursor < 0 || cursor > lastSegment || time < timestamps[cursor])
+        cursor = -1;
+    else
+    {
+        for(int i = 0; i < CURSOR_MAX_STEPS; ++i)
+        {
+            if(cursor == lastSegment || time < timestamps[cursor + 1])
+                return cursor;
+
+            ++cursor;
+        }
+
+        cursor = -1;
+    }
+
+    // seek or wrap-around
+    auto it = std::upper_bound(timestamps.begin() + 1, timestamps.end() - 1, time);
+    return it - timestamps.begin() - 1;
+}
+
+static float getTransition(const std::vector<float>& timestamps, int idx, float time)
+{
+    const float start = timestamps[idx];
+    const float end = timestamps[idx + 1];
+    return min(max((time - start) / (end - start), 0.f), 1.f);
+}
+
+// full precision keys of one track
+template<typename T>
+struct ImportTrack
+{
+    std::vector<float> timestamps;
+    std::vector<T> values;
+};
+
+static vec3 interpolate(vec3 v1, vec3 v2, float a) { return lerp(v1, v2, a); }
+static quat interpolate(quat q1, quat q2, float a) { return nlerp(q1, q2, a); }
+
+template<typename T>
+static T sampleImportTrack(const ImportTrack<T>& track, float time)
+{
+    if(track.values.size() == 1)
+        return track.values.front();
+
+    const int idx = findKey(track.timestamps, time, -1);
+    return interpolate(track.values[idx], track.values[idx + 1], getTransition(track.timestamps, idx, time));
+}
+
+// true if all keys between first and last can be reconstructed from them
+template<typename T>
+static bool canReconstruct(const ImportTrack<T>& track, int first, int last, float tolerance)
+{
+    for(int i = first + 1; i < last; ++i)
+    {
+        const float t = (track.timestamps[i] - track.timestamps[first]) /
+                        (track.timestamps[last] - track.timestamps[first]);
+
+        const T value = interpolate(track.values[first], track.values[last], t);
+
+        if(getError(value, track.values[i]) > tolerance)
+            return false;
+    }
+
+    return true;
+}
+
+// removes the keys that linear interpolation can reconstruct within tolerance, a constant track
+// is reduced to a single key; if keepAll is set only constant tracks are reduced
+template<typename T>
+static void reduceKeys(ImportTrack<T>& track, float tolerance, bool keepAll)
+{
+    bool constant = true;
+
+    for(const T& value: track.values)
+        constant = constant && getError(track.values.front(), value) <= tolerance;
+
+    if(constant)
+    {
+        track.timestamps.resize(1);
+        track.values.resize(1);
+        return;
+    }
+
+    if(keepAll)
+        return;
+
+    ImportTrack<T> reduced;
+    reduced.timestamps.push_back(track.timestamps.front());
+    reduced.values.push_back(track.values.front());
+    int anchor = 0;
+
+    for(int i = 2; i < int(track.values.size()); ++i)
+    {
+        if(canReconstruct(track, anchor, i, tolerance))
+            continue;
+
+        anchor = i - 1;
+        reduced.timestamps.push_back(track.timestamps[anchor]);
+        reduced.values.push_back(track.values[anchor]);
+    }
+
+    reduced.timestamps.push_back(track.timestamps.back());
+    reduced.values.push_back(track.values.back());
+    track = std::move(reduced);
+}
+
+template<typename T>
+static void resample(ImportTrack<T>& track, float sampleRate, int frameCount)
+{
+    if(track.values.size() == 1)
+        return;
+
+    ImportTrack<T> resampled;
+
+    for(int i = 0; i < frameCount; ++i)
+    {
+        const float time = i / sampleRate;
+        resampled.timestamps.push_back(time);
+        resampled.values.push_back(sampleImportTrack(track, time));
+    }
+
+    track = std::move(resampled);
+}
+
+static Vec3Track packTrack(const ImportTrack<vec3>& track, bool resampled)
+{
+    Vec3Track packed;
+    vec3 max(-INFINITY);
+    packed.min = vec3(INFINITY);
+
+    for(vec3 v: track.values)
+    {
+        for(int i = 0; i < 3; ++i)
+        {
+            packed.min[i] = ::min(packed.min[i], v[i]);
+            max[i] = ::max(max[i], v[i]);
+        }
+    }
+
+    packed.extent = max - packed.min;
+
+    for(vec3 v: track.values)
+        packed.values.push_back(packVec3(v, packed.min, packed.extent));
+
+    if(track.values.size() > 1 && !resampled)
+        packed.timestamps = track.timestamps;
+
+    return packed;
+}
+
+static RotationTrack packTrack(const ImportTrack<quat>& track, bool resampled)
+{
+    RotationTrack packed;
+
+    for(quat q: track.values)
+        packed.values.push_back(packQuat(q));
+
+    if(track.values.size() > 1 && !resampled)
+        packed.timestamps = track.timestamps;
+
+    return packed;
+}
+
+void compressAnimation(Animation& animation, const std::vector<BoneKeys>& keys, const AnimationCompression& settings)
+{
+    const bool resampled = settings.sampleRate > 0.f;
+    animation.sampleRate = resampled ? settings.sampleRate : 0.f;
+    animation.frameCount = 0;
+    animation.channels.clear();
+
+    if(resampled)
+    {
+        float endTime = 0.f;
+
+        for(const BoneKeys& boneKeys: keys)
+        {
+            for(const PositionKey& key: boneKeys.positionKeys)
+                endTime = max(endTime, key.timestamp);
+            for(const RotationKey& key: boneKeys.rotationKeys)
+                endTime = max(endTime, key.timestamp);
+            for(const ScaleKey& key: boneKeys.scaleKeys)
+                endTime = max(endTime, key.timestamp);
+        }
+
+        animation.frameCount = max(2, int(ceilf(endTime * settings.sampleRate)) + 1);
+    }
+
+    for(const BoneKeys& boneKeys: keys)
+    {
+        ImportTrack<vec3> positions;
+        ImportTrack<quat> rotations;
+        ImportTrack<vec3> scales;
+
+        for(const PositionKey& key: boneKeys.positionKeys)
+        {
+            positions.timestamps.push_back(key.timestamp);
+            positions.values.push_back(key.position);
+        }
+
+        for(const RotationKey& key: boneKeys.rotationKeys)
+        {
+            rotations.timestamps.push_back(key.timestamp);
+            rotations.values.push_back(normalize(key.rotation));
+        }
+
+        for(const ScaleKey& key: boneKeys.scaleKeys)
+        {
+            scales.timestamps.push_back(key.timestamp);
+            scales.values.push_back(key.scale);
+        }
+
+        // identity for missing tracks
+        if(positions.values.empty())
+        {
+            positions.timestamps.push_back(0.f);
+            positions.values.push_back(vec3(0.f));
+        }
+
+        if(rotations.values.empty())
+        {
+            rotations.timestamps.push_back(0.f);
+            rotations.values.push_back(quat());
+        }
+
+        if(scales.values.empty())
+        {
+            scales.timestamps.push_back(0.f);
+            scales.values.push_back(vec3(1.f));
+        }
+
+        reduceKeys(positions, settings.positionTolerance, resampled);
+        reduceKeys(rotations, settings.rotationTolerance, resampled);
+        reduceKeys(scales, settings.scaleTolerance, resampled);
+
+        if(resampled)
+        {
+            resample(positions, settings.sampleRate, animation.frameCount);
+            resample(rotations, settings.sampleRate, animation.frameCount);
+            resample(scales, settings.sampleRate, animation.frameCount);
+        }
+
+        BoneChannel channel;
+        channel.position = packTrack(positions, resampled);
+        channel.rotation = packTrack(rotations, resampled);
+        channel.scale = packTrack(scales, resampled);
+
+        // constant tracks do not take part in the search
+        const std::vector<float>* timestamps[] = {&channel.position.timestamps, &channel.rotation.timestamps,
+                                                  &channel.scale.timestamps};
+        const std::vector<float>* shared = nullptr;
+        channel.sharedTimestamps = !resampled;
+
+        for(const std::vector<float>* t: timestamps)
+        {
+            if(t->empty())
+                continue;
+
+            if(!shared)
+                shared = t;
+            else if(*t != *shared)
+                channel.sharedTimestamps = false;
+        }
+
+        animation.channels.push_back(std::move(channel));
+    }
+}
+
+int getMemorySize(const BoneKeys& keys)
+{
+    return keys.positionKeys.size() * sizeof(PositionKey) + keys.rotationKeys.size() * sizeof(RotationKey) +
+           keys.scaleKeys.size() * sizeof(ScaleKey);
+}
+
+int getMemorySize(const Animation& animation)
+{
+    int size = animation.channelIndices.size() * sizeof(int);
+
+    for(const BoneChannel& channel: animation.channels)
+    {
+        size += sizeof(BoneChannel);
+        size += channel.position.timestamps.size() * sizeof(float) + channel.position.values.size() * sizeof(PackedVec3);
+        size += channel.rotation.timestamps.size() * sizeof(float) + channel.rotation.values.size() * sizeof(PackedQuat);
+        size += channel.scale.timestamps.size() * sizeof(float) + channel.scale.values.size() * sizeof(PackedVec3);
+    }
+
+    return size;
+}
+
+// updates the cursor, returns the segment and the transition inside of it
+static int sampleKeys(const std::vector<float>& timestamps, float time, int& cursor, float& transition)
+{
+    cursor = findKey(timestamps, time, cursor);
+    transition = getTransition(timestamps, cursor, time);
+    return cursor;
+}
+
+static vec3 decodeTrack(const Vec3Track& track, int idx, float transition)
+{
+    if(track.values.size() == 1)
+        return unpackVec3(track.values.front(), track.min, track.extent);
+
+    return lerp(unpackVec3(track.values[idx], track.min, track.extent),
+                unpackVec3(track.values[idx + 1], track.min, track.extent), transition);
+}
+
+static quat decodeTrack(const RotationTrack& track, int idx, float transition)
+{
+    if(track.values.size() == 1)
+        return unpackQuat(track.values.front());
+
+    return nlerp(unpackQuat(track.values[idx]), unpackQuat(track.values[idx + 1]), transition);
+}
+
+static void sampleBone(const Animation& animation, const BoneChannel& channel, float time, KeyCursor& cursor,
+                       vec3& translation, quat& rotation, vec3& scale)
+{
+    float tPosition = 0.f, tRotation = 0.f, tScale = 0.f;
+    int idxPosition = 0, idxRotation = 0, idxScale = 0;
+
+    if(animation.sampleRate > 0.f)
+    {
+        // uniform keys, no search
+        const float frame = max(time * animation.sampleRate, 0.f);
+        idxPosition = min(int(frame), animation.frameCount - 2);
+        tPosition = min(frame - idxPosition, 1.f);
+        idxRotation = idxScale = idxPosition;
+        tRotation = tScale = tPosition;
+    }
+    else if(channel.sharedTimestamps)
+    {
+        const std::vector<float>& timestamps = !channel.position.timestamps.empty() ? channel.position.timestamps :
+                                               !channel.rotation.timestamps.empty() ? channel.rotation.timestamps :
+                                               channel.scale.timestamps;
+        if(!timestamps.empty())
+        {
+            idxPosition = idxRotation = idxScale = sampleKeys(timestamps, time, cursor.position, tPosition);
+            tRotation = tScale = tPosition;
+        }
+    }
+    else
+    {
+        if(!channel.position.timestamps.empty())
+            idxPosition = sampleKeys(channel.position.timestamps, time, cursor.position, tPosition);
+
+        if(!channel.rotation.timestamps.empty())
+            idxRotation = sampleKeys(channel.rotation.timestamps, time, cursor.rotation, tRotation);
+
+        if(!channel.scale.timestamps.empty())
+            idxScale = sampleKeys(channel.scale.timestamps, time, cursor.scale, tScale);
+    }
+
+    translation = decodeTrack(channel.position, idxPosition, tPosition);
+    rotation = decodeTrack(channel.rotation, idxRotation, tRotation);
+    scale = decodeTrack(channel.scale, idxScale, tScale);
+}
+
+mat4 sampleChannel(const Animation& animation, int idxChannel, float time, KeyCursor& cursor)
+{
+    vec3 translation, scale;
+    quat rotation;
+    sampleBone(animation, animation.channels[idxChannel], time, cursor, translation, rotation, scale);
+    return composeTRS(translation, rotation, scale);
+}
+
+void initReducedNodes(Skeleton& skeleton, const std::vector<float>& boneWeights, float minWeightFraction)
+{
+    const int nodeCount = skeleton.nodeCount();
+    std::vector<float> subtreeWeights(nodeCount, 0.f);
+    float totalWeight = 0.f;
+
+    for(int i = 0; i < nodeCount; ++i)
+    {
+        if(skeleton.boneIndices[i] < MAX_BONES)
+        {
+            subtreeWeights[i] = boneWeights[skeleton.boneIndices[i]];
+            totalWeight += subtreeWeights[i];
+        }
+    }
+
+    // children go after their parents
+    for(int i = nodeCount - 1; i > 0; --i)
+    {
+        if(skeleton.parents[i] != -1)
+            subtreeWeights[skeleton.parents[i]] += subtreeWeights[i];
+    }
+
+    skeleton.reducedNodes.resize(nodeCount);
+    skeleton.reducedNodeCount = 0;
+
+    for(int i = 0; i < nodeCount; ++i)
+    {
+        const int parent = skeleton.parents[i];
+        const bool parentIncluded = parent == -1 || skeleton.reducedNodes[parent];
+
+        skeleton.reducedNodes[i] = parentIncluded && subtreeWeights[i] >= minWeightFraction * totalWeight;
+        skeleton.reducedNodeCount += skeleton.reducedNodes[i];
+    }
+}
+
+void updateBones(const Skeleton& skeleton, const Animation& animation, float time, KeyCursor* cursors,
+                 mat4* nodeTransforms, mat4* boneTransformations, bool reduced)
+{
+    const int nodeCount = skeleton.nodeCount();
+    const int* parents = skeleton.parents.data();
+    const int* channelIndices = animation.channelIndices.data();
+    const int* boneIndices = skeleton.boneIndices.data();
+    const unsigned char* reducedNodes = reduced ? skeleton.reducedNodes.data() : nullptr;
+
+    // the sampled nodes of a block are composed in one batch
+    enum {BLOCK_SIZE = 64};
+    vec3 translations[BLOCK_SIZE];
+    quat rotations[BLOCK_SIZE];
+    vec3 scales[BLOCK_SIZE];
+    mat4 sampled[BLOCK_SIZE];
+
+    for(int first = 0; first < nodeCount; first += BLOCK_SIZE)
+    {
+        const int last = min(first + BLOCK_SIZE, nodeCount);
+        int count = 0;
+
+        for(int i = first; i < last; ++i)
+        {
+            const int idxChannel = reducedNodes && !reducedNodes[i] ? -1 : channelIndices[i];
+
+            if(idxChannel != -1)
+            {
+                sampleBone(animation, animation.channels[idxChannel], time, cursors[i], translations[count],
+                           rotations[count], scales[count]);
+                ++count;
+            }
+        }
+
+        composeTRS(translations, rotations, scales, sampled, count);
+        count = 0;
+
+        for(int i = first; i < last; ++i)
+        {
+            const int idxChannel = reducedNodes && !reducedNodes[i] ? -1 : channelIndices[i];
+            const mat4& transform = idxChannel == -1 ? skeleton.localTransforms[i] : sampled[count++];
+
+            // parents[i] < i
+            if(parents[i] == -1)
+                nodeTransforms[i] = transform;
+            else
+                multiply(nodeTransforms[parents[i]], transform, nodeTransforms[i]);
+
+            if(boneIndices[i] < MAX_BONES)
+                multiply(nodeTransforms[i], skeleton.inverseBindTransforms[i], boneTransformations[boneIndices[i]]);
+        }
+    }
+}
+
+void packPalette(const mat4* bones, const int* boneMap, int count, int skinning, vec4* texels)
+{
+    for(int i = 0; i < count; ++i)
+    {
+        const mat4& m = bones[boneMap[i]];
+
+        if(skinning == SKINNING_DUAL_QUAT)
+        {
+            mat4 rotation;
+            rotation.i = vec4(normalize(vec3(m.i)), 0.f);
+            rotation.j = vec4(normalize(vec3(m.j)), 0.f);
+            rotation.k = vec4(normalize(vec3(m.k)), 0.f);
+            const quat real = toQuat(rotation);
+            const quat dual = quat(m.w.x, m.w.y, m.w.z, 0.f) * real;
+            *texels++ = {real.x, real.y, real.z, real.w};
+            *texels++ = vec4(dual.x, dual.y, dual.z, dual.w) * 0.5f;
+        }
+        else
+        {
+            *texels++ = {m.i.x, m.j.x, m.k.x, m.w.x};
+            *texels++ = {m.i.y, m.j.y, m.k.y, m.w.y};
+            *texels++ = {m.i.z, m.j.z, m.k.z, m.w.z};
+        }
+    }
+}
+
+void bakeAnimations(const Skeleton& skeleton, const std::vector<int>& boneMap, float sampleRate,
+                    BakedAnimations& baked)
+{
+    const int boneCount = boneMap.size();
+    baked.sampleRate = sampleRate;
+    baked.boneCount = boneCount;
+    baked.clipRows.clear();
+    baked.clipFrames.clear();
+    baked.texels.clear();
+
+    std::vector<KeyCursor> cursors(skeleton.nodeCount());
+    std::vector<mat4> nodeTransforms(skeleton.nodeCount());
+    std::vector<mat4> bones(MAX_BONES);
+    int rows = 0;
+
+    for(const Animation& animation: skeleton.animations)
+    {
+        const int frames = max(1, int(ceilf(animation.duration * sampleRate)));
+        baked.clipRows.push_back(rows);
+        baked.clipFrames.push_back(frames);
+
+        for(int i = 0; i <= frames; ++i)
+        {
+            const float time = (i % frames) * animation.duration / frames;
+            updateBones(skeleton, animation, time, cursors.data(), nodeTransforms.data(), bones.data());
+
+            baked.texels.resize(baked.texels.size() + boneCount * 3);
+            packPalette(bones.data(), boneMap.data(), boneCount, SKINNING_MAT3X4,
+                        &baked.texels[baked.texels.size() - boneCount * 3]);
+        }
+
+        rows += frames + 1;
+    }
+}
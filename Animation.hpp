@@ -0,0 +1,191 @@
+#pragma once
+
+#include "math.hpp"
+
+#include <vector>
+#include <string>
+
+enum
+{
+    MAX_WEIGHTS = 4,
+    MAX_BONES = 256 // per model; vertices index the palette of their mesh
+};
+
+// format of the bone palettes in the texture buffers
+enum
+{
+    SKINNING_MAT3X4, // 3 texels per bone, rows of the affine transformation
+    SKINNING_DUAL_QUAT, // 2 texels per bone, real and dual part; rigid transformations only, scale is dropped
+    SKINNING_COUNT
+};
+
+inline int getTexelsPerBone(int skinning)
+{
+    return skinning == SKINNING_DUAL_QUAT ? 2 : 3;
+}
+
+// full precision keys, only used during import
+
+struct PositionKey
+{
+    // transformation relative to parent bone
+    vec3 position;
+    float timestamp;
+};
+
+struct RotationKey
+{
+    quat rotation;
+    float timestamp;
+};
+
+struct ScaleKey
+{
+    vec3 scale;
+    float timestamp;
+};
+
+struct BoneKeys
+{
+    std::vector<PositionKey> positionKeys;
+    std::vector<RotationKey> rotationKeys;
+    std::vector<ScaleKey> scaleKeys;
+};
+
+// compressed keys used at runtime
+
+// 16 bits per component, relative to the range of the track
+struct PackedVec3
+{
+    unsigned short v[3];
+};
+
+// smallest three; the largest component is dropped and reconstructed from the unit length,
+// the other three take 15 bits each, the lowest bits of v[0] and v[1] store the index of the dropped one
+struct PackedQuat
+{
+    unsigned short v[3];
+};
+
+struct Vec3Track
+{
+    vec3 min = vec3(0.f);
+    vec3 extent = vec3(0.f);
+    std::vector<float> timestamps; // empty if the track is constant or the clip is resampled
+    std::vector<PackedVec3> values; // one value - constant track
+};
+
+struct RotationTrack
+{
+    std::vector<float> timestamps;
+    std::vector<PackedQuat> values;
+};
+
+struct BoneChannel
+{
+    Vec3Track position;
+    RotationTrack rotation;
+    Vec3Track scale;
+
+    // all non-constant tracks have keys at the same timestamps, one search is enough
+    bool sharedTimestamps = false;
+};
+
+struct AnimationCompression
+{
+    // maximum error of the keys removed by linear interpolation, also used to detect constant tracks
+    float positionTolerance = 0.001f;
+    float rotationTolerance = 0.0005f; // per quaternion component
+    float scaleTolerance = 0.0001f;
+
+    // keys per time unit of the timestamps; 0 - keep the (reduced) original keys, otherwise
+    // keys are resampled uniformly and not reduced, sampling is done without any search
+    float sampleRate = 0.f;
+};
+
+struct Animation
+{
+    std::string name;
+    float duration;
+    float sampleRate = 0.f;
+    int frameCount = 0; // if resampled
+    std::vector<BoneChannel> channels;
+    std::vector<int> channelIndices; // one per skeleton node, -1 - node is not animated
+
+    // model space bounds of the skinned meshes, [sample * meshCount + mesh]; see computeAnimationBounds()
+    std::vector<vec3> boundsMin;
+    std::vector<vec3> boundsMax;
+    std::vector<float> boundsTravel; // the farthest a vertex moves from the sample to the next one
+    int boundsSampleCount = 0;
+};
+
+// node hierarchy flattened into parallel arrays ordered parent-before-child, so the pose is
+// evaluated with a single forward loop
+struct Skeleton
+{
+    std::vector<Animation> animations;
+    std::vector<int> parents; // -1 - root
+    std::vector<mat4> localTransforms; // relative to parent, used when the node is not animated
+    std::vector<mat4> inverseBindTransforms; // from mesh to bone space
+    std::vector<int> boneIndices; // MAX_BONES - node does not affect any vertices
+
+    // 1 - node is evaluated at the reduced level of detail, the others keep the bind pose
+    // relative to their parent; whole subtrees are excluded
+    std::vector<unsigned char> reducedNodes;
+    int reducedNodeCount = 0;
+
+    int nodeCount() const { return parents.size(); }
+};
+
+// boneWeights - sum of the vertex weights of every bone; a node is excluded if its subtree
+// has less than minWeightFraction of the total weight
+void initReducedNodes(Skeleton& skeleton, const std::vector<float>& boneWeights, float minWeightFraction);
+
+// key segments found in the previous sampling of a node; playback is monotonic (except
+// at wrap-around) so the next search starts from here
+struct KeyCursor
+{
+    int position = 0;
+    int rotation = 0;
+    int scale = 0;
+};
+
+// bone palettes of all clips of a skeleton sampled at a fixed rate, for playback without
+// evaluating the skeleton; a row stores a frame, boneCount * 3 texels (SKINNING_MAT3X4 palette);
+// every clip gets an extra frame equal to its first one, so interpolation between the rows
+// works at wrap-around
+struct BakedAnimations
+{
+    float sampleRate;
+    int boneCount;
+    std::vector<int> clipRows; // first row of every clip
+    std::vector<int> clipFrames; // without the extra frame, spread evenly over the clip duration
+    std::vector<vec4> texels;
+
+    int width() const { return boneCount * 3; }
+    int height() const { return texels.size() / width(); }
+};
+
+// boneMap - palette bone -> skeleton bone, the rows use the same layout
+void bakeAnimations(const Skeleton& skeleton, const std::vector<int>& boneMap, float sampleRate,
+                    BakedAnimations& baked);
+
+// texels - count * getTexelsPerBone(skinning) elements, bone i of the palette is bones[boneMap[i]]
+void packPalette(const mat4* bones, const int* boneMap, int count, int skinning, vec4* texels);
+
+// fills animation.channels, keys are indexed the same way
+void compressAnimation(Animation& animation, const std::vector<BoneKeys>& keys, const AnimationCompression& settings);
+
+// size of the key data in bytes
+int getMemorySize(const BoneKeys& keys);
+int getMemorySize(const Animation& animation);
+
+// transformation of one node relative to its parent; updateBones() samples whole skeletons in
+// batches, this is for the code that walks the nodes itself
+mat4 sampleChannel(const Animation& animation, int idxChannel, float time, KeyCursor& cursor);
+
+// cursors, nodeTransforms - skeleton.nodeCount() elements, any cursor values are valid;
+// nodeTransforms receives global transformations of the nodes; reduced - evaluate only
+// skeleton.reducedNodes
+void updateBones(const Skeleton& skeleton, const Animation& animation, float time, KeyCursor* cursors,
+                 mat4* nodeTransforms, mat4* boneTransformations, bool reduced = false);
@@ -1,64 +1,64 @@
 #pragma once
 
+#include "Memory.hpp"
+
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 // does not respect constructors & destructors
-template<typename T>
-class Array
+// Allocator - storage and growth policy, see Memory.hpp
+template<typename T, typename Allocator = HeapAllocator>
+class Array: private Allocator
 {
 public:
 	Array() = default;
-	~Array() { free(data_); }
-	Array(const Array<T>&) = delete;
-	Array<T>& operator=(const Array<T>&) = delete;
+	explicit Array(const Allocator& allocator): Allocator(allocator) {}
+	~Array() { Allocator::deallocate(data_, capacity_ * sizeof(T)); }
+	Array(const Array&) = delete;
+	Array& operator=(const Array&) = delete;
 
-	void swap(Array<T>& other)
+	void swap(Array& other)
 	{
+		static_assert(Allocator::MOVABLE, "the storage is inside of the array");
+
 		int size = other.size_;
 		int capacity = other.capacity_;
 		T* data = other.data_;
+		Allocator allocator = other;
 
 		other.size_ = size_;
 		other.capacity_ = capacity_;
 		other.data_ = data_;
+		(Allocator&)other = *this;
 
 		size_ = size;
 		capacity_ = capacity;
 		data_ = data;
+		(Allocator&)*this = allocator;
 	}
 
 	void pushBack(const T& val)
 	{
-		++size_;
-		if (size_ > capacity_)
-		{
-			capacity_ = size_ * 2;
-			grow();
-		}
-		data_[size_ - 1] = val;
-	}
+		if (size_ == capacity_)
+			grow(Allocator::getCapacity(size_ + 1, sizeof(T)));
 
+		data_[size_++] = val;
+	}
 
 	void reserve(int size)
 	{
 		if (size > capacity_)
-		{
-			capacity_ = size;
-			grow();
-		}
+			grow(size);
 	}
 
-	// @ not tested
 	T& insert(int i, const T& val)
 	{
+		if (size_ == capacity_)
+			grow(Allocator::getCapacity(size_ + 1, sizeof(T)));
+
+		memmove(data_ + i + 1, data_ + i, (size_ - i) * sizeof(T));
 		++size_;
-		if (size_ > capacity_)
-		{
-			capacity_ = size_ * 2;
-			grow();
-		}
-		memmove(data_ + i + 1, data_ + i, size_ - i - 1);
 		data_[i] = val;
 		return data_[i];
 	}
@@ -71,19 +71,15 @@ public:
 
 	T& erase(int i, int count)
 	{
-		memmove(data_ + i, data_ + i + count, size_ - i - count);
+		memmove(data_ + i, data_ + i + count, (size_ - i - count) * sizeof(T));
 		size_ -= count;
 		return data_[i];
 	}
 
 	void resize(int size)
 	{
+		reserve(size);
 		size_ = size;
-		if (size_ > capacity_)
-		{
-			capacity_ = size_;
-			grow();
-		}
 	}
 
 	void     clear() { size_ = 0; }
@@ -102,19 +98,29 @@ public:
 	const T* data()            const { return data_; }
 	bool     empty()           const { return size_ == 0; }
 	int      size()            const { return size_; }
+	int      capacity()        const { return capacity_; }
+	const Allocator& getAllocator() const { return *this; }
 
 private:
 	int size_ = 0;
 	int capacity_ = 0;
 	T* data_ = nullptr;
 
-	void grow()
+	void grow(int capacity)
 	{
-		data_ = (T*)realloc(data_, capacity_ * sizeof(T));
-		assert(data_);
+		data_ = (T*)Allocator::reallocate(data_, size_ * sizeof(T), capacity_ * sizeof(T), capacity * sizeof(T));
+		capacity_ = capacity;
 	}
 };
 
+// in the frame arena of the thread that created it, must not outlive the next frame of that thread
+template<typename T>
+using FrameArray = Array<T, ArenaAllocator>;
+
+// no heap calls until it has more than N elements; can't be swapped
+template<typename T, int N>
+using SmallArray = Array<T, InlineAllocator<sizeof(T) * N, alignof(T)>>;
+
 // does not respect constructors & destructors
 template<typename T, int N>
 class FixedArray
@@ -149,3 +155,93 @@ private:
 	int size_ = 0;
 	T data_[N];
 };
+
+// non-owning view of contiguous elements
+template<typename T>
+class Span
+{
+public:
+	Span() = default;
+	Span(T* data, int size): data_(data), size_(size) {}
+
+	template<int N>
+	Span(T(&array)[N]): data_(array), size_(N) {}
+
+	// from any of the arrays above, also Span<const T> from a mutable one
+	template<typename C, typename = decltype(static_cast<T*>(((C*)nullptr)->data()))>
+	Span(C& container): data_(container.data()), size_(container.size()) {}
+
+	Span<T>  subspan(int first, int count) const { assert(first + count <= size_); return {data_ + first, count}; }
+	T&       operator[](int i) const { assert(i < size_); return data_[i]; }
+	T*       begin()           const { return data_; }
+	T*       end()             const { return data_ + size_; }
+	T*       data()            const { return data_; }
+	bool     empty()           const { return size_ == 0; }
+	int      size()            const { return size_; }
+
+private:
+	T* data_ = nullptr;
+	int size_ = 0;
+};
+
+// stable indices, removed slots are reused through a free list
+// does not respect constructors & destructors
+template<typename T>
+class Pool
+{
+public:
+	int add(const T& val)
+	{
+		int idx;
+
+		if (firstFree_ != -1)
+		{
+			idx = firstFree_;
+			firstFree_ = slots_[idx].next;
+			slots_[idx].next = ALIVE;
+		}
+		else
+		{
+			idx = slots_.size();
+			slots_.pushBack({{}, ALIVE});
+		}
+
+		slots_[idx].value = val;
+		++size_;
+		return idx;
+	}
+
+	void remove(int idx)
+	{
+		assert(isAlive(idx));
+		slots_[idx].next = firstFree_;
+		firstFree_ = idx;
+		--size_;
+	}
+
+	bool     isAlive(int idx)  const { return idx >= 0 && idx < slots_.size() && slots_[idx].next == ALIVE; }
+	T&       operator[](int idx) { assert(isAlive(idx)); return slots_[idx].value; }
+	const T& operator[](int idx) const { assert(isAlive(idx)); return slots_[idx].value; }
+	int      size()            const { return size_; } // alive
+	int      maxIndex()        const { return slots_.size(); } // for iteration with isAlive()
+
+	void clear()
+	{
+		slots_.clear();
+		firstFree_ = -1;
+		size_ = 0;
+	}
+
+private:
+	enum {ALIVE = -2};
+
+	struct Slot
+	{
+		T value;
+		int next; // ALIVE or the next free slot
+	};
+
+	Array<Slot> slots_;
+	int firstFree_ = -1;
+	int size_ = 0;
+};
@@ -0,0 +1,593 @@
+#include "Benchmarks.hpp"
+#include "Animation.hpp"
+#include "JobSystem.hpp"
+#include "Memory.hpp"
+#include "HashMap.hpp"
+#include "api.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+
+#include <chrono>
+#include <vector>
+#include <string>
+#include <map>
+#include <unordered_map>
+
+// seconds, as glfwGetTime() without the window dependency
+static double getTime()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static float randomFloat()
+{
+    return rand() / float(RAND_MAX);
+}
+
+template<typename T>
+static void pushBack(std::vector<T>& container, const T& val)
+{
+    container.push_back(val);
+}
+
+template<typename T, typename Allocator>
+static void pushBack(Array<T, Allocator>& container, const T& val)
+{
+    container.pushBack(val);
+}
+
+// as the vertex data in loadModel(), one float at a time into a container reused by every mesh
+// (reused == true) or created for every mesh; returns ns per push
+template<typename C>
+static double benchmarkLoaderPushes(Span<const int> meshSizes, bool reused, long long& heapCalls)
+{
+    const HeapStats heapStart = getHeapStats();
+    const double start = getTime();
+    long long pushCount = 0;
+    volatile float checksum = 0.f;
+    C sharedContainer;
+
+    for(int size: meshSizes)
+    {
+        C localContainer;
+        C& container = reused ? sharedContainer : localContainer;
+        container.clear();
+
+        for(int i = 0; i < size; ++i)
+            pushBack(container, float(i));
+
+        checksum = checksum + container[size / 2];
+        pushCount += size;
+    }
+
+    heapCalls = getHeapStats().allocations - heapStart.allocations;
+    return (getTime() - start) * 1000000000.0 / pushCount;
+}
+
+// as the bone weights of a vertex, a few elements in a short lived container; returns ns per container
+template<typename C>
+static double benchmarkSmallContainers(int count, long long& heapCalls)
+{
+    const HeapStats heapStart = getHeapStats();
+    const double start = getTime();
+    volatile int checksum = 0;
+
+    for(int i = 0; i < count; ++i)
+    {
+        C container;
+
+        for(int k = 0; k < 1 + i % MAX_WEIGHTS; ++k)
+            pushBack(container, i + k);
+
+        checksum = checksum + container[0];
+    }
+
+    heapCalls = getHeapStats().allocations - heapStart.allocations;
+    return (getTime() - start) * 1000000000.0 / count;
+}
+
+void benchmarkContainers(double (&nsPerPush)[3][4], long long (&heapCalls)[3][4])
+{
+    Array<int> meshSizes;
+
+    // vertex counts of sponza like meshes, 14 floats per vertex
+    for(int i = 0; i < 200; ++i)
+        meshSizes.pushBack((500 + rand() % 20000) * 14);
+
+    for(int k = 0; k < 2; ++k)
+    {
+        const bool reused = k == 0;
+        nsPerPush[k][0] = benchmarkLoaderPushes<std::vector<float>>(meshSizes, reused, heapCalls[k][0]);
+        nsPerPush[k][1] = benchmarkLoaderPushes<Array<float>>(meshSizes, reused, heapCalls[k][1]);
+        nsPerPush[k][2] = benchmarkLoaderPushes<Array<float, PoolAllocator>>(meshSizes, reused, heapCalls[k][2]);
+        nsPerPush[k][3] = benchmarkLoaderPushes<FrameArray<float>>(meshSizes, reused, heapCalls[k][3]);
+
+        log("containers, %s vertex data: std::vector %.2f ns (%lld heap calls), Array %.2f ns (%lld), pool %.2f ns "
+            "(%lld), frame arena %.2f ns (%lld) per push", reused ? "reused" : "per mesh", nsPerPush[k][0],
+            heapCalls[k][0], nsPerPush[k][1], heapCalls[k][1], nsPerPush[k][2], heapCalls[k][2], nsPerPush[k][3],
+            heapCalls[k][3]);
+    }
+
+    const int count = 1000000;
+    nsPerPush[2][0] = benchmarkSmallContainers<std::vector<int>>(count, heapCalls[2][0]);
+    nsPerPush[2][1] = benchmarkSmallContainers<Array<int>>(count, heapCalls[2][1]);
+    nsPerPush[2][2] = benchmarkSmallContainers<Array<int, PoolAllocator>>(count, heapCalls[2][2]);
+    nsPerPush[2][3] = benchmarkSmallContainers<SmallArray<int, MAX_WEIGHTS>>(count, heapCalls[2][3]);
+
+    log("containers, %d small arrays: std::vector %.2f ns (%lld heap calls), Array %.2f ns (%lld), pool %.2f ns "
+        "(%lld), SmallArray %.2f ns (%lld) per array", count, nsPerPush[2][0], heapCalls[2][0], nsPerPush[2][1],
+        heapCalls[2][1], nsPerPush[2][2], heapCalls[2][2], nsPerPush[2][3], heapCalls[2][3]);
+}
+
+// name -> index as in the loader (bone, node and texture names), the name is a C string as the
+// ones of assimp; returns ns per lookup
+static void benchmarkNameLookups(int nameCount, int lookupCount, double (&nsPerLookup)[3])
+{
+    std::vector<std::string> names;
+    std::map<std::string, int> orderedMap;
+    std::unordered_map<std::string, int> unorderedMap;
+    StringTable stringTable;
+    HashMap<int, int> hashMap;
+
+    for(int i = 0; i < nameCount; ++i)
+    {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "textures/sponza_material_%d_diff.tga", i);
+        names.push_back(buf);
+        orderedMap[buf] = i;
+        unorderedMap[buf] = i;
+        hashMap.insert(stringTable.intern(buf), i);
+    }
+
+    Array<const char*> queries;
+
+    for(int i = 0; i < lookupCount; ++i)
+        queries.pushBack(names[rand() % nameCount].c_str());
+
+    volatile int checksum = 0;
+    double start = getTime();
+
+    for(const char* query: queries)
+        checksum = checksum + orderedMap.find(query)->second;
+
+    nsPerLookup[0] = (getTime() - start) * 1000000000.0 / lookupCount;
+    start = getTime();
+
+    for(const char* query: queries)
+        checksum = checksum + unorderedMap.find(query)->second;
+
+    nsPerLookup[1] = (getTime() - start) * 1000000000.0 / lookupCount;
+    start = getTime();
+
+    for(const char* query: queries)
+        checksum = checksum + *hashMap.find(stringTable.find(query));
+
+    nsPerLookup[2] = (getTime() - start) * 1000000000.0 / lookupCount;
+}
+
+template<typename M>
+static int findOrAddSlot(M& slots, long long key, int value)
+{
+    return slots.insert({key, value}).first->second;
+}
+
+static int findOrAddSlot(HashMap<long long, int, ArenaAllocator>& slots, long long key, int value)
+{
+    return slots.insert(key, value);
+}
+
+// as the pose cache slots, a map built from the keys of all animated models every frame in an arena;
+// returns ns per model
+template<typename M, typename Allocator>
+static double benchmarkPoseSlots(Span<const long long> keys, int frameCount)
+{
+    Arena arena;
+    volatile int checksum = 0;
+    const double start = getTime();
+
+    for(int frame = 0; frame < frameCount; ++frame)
+    {
+        {
+            M slots{Allocator(arena)};
+            int owners = 0;
+
+            for(long long key: keys)
+            {
+                const int owner = findOrAddSlot(slots, key, owners);
+                owners += owner == owners;
+            }
+
+            checksum = checksum + owners;
+        }
+
+        arena.reset();
+    }
+
+    return (getTime() - start) * 1000000000.0 / (double(keys.size()) * frameCount);
+}
+
+void benchmarkHashMaps(double (&nsPerLookup)[2][3])
+{
+    benchmarkNameLookups(400, 1000000, nsPerLookup[0]);
+
+    log("maps, 400 names: std::map %.2f ns, std::unordered_map %.2f ns, StringTable + HashMap %.2f ns per lookup",
+        nsPerLookup[0][0], nsPerLookup[0][1], nsPerLookup[0][2]);
+
+    // 10000 instances of 4 skeletons x 8 clips x 30 time steps
+    Array<long long> keys;
+
+    for(int i = 0; i < 10000; ++i)
+        keys.pushBack((long long)(rand() % 4) << 48 | (long long)(rand() % 8) << 32 | rand() % 30);
+
+    using Pair = std::pair<const long long, int>;
+    const int frameCount = 100;
+    nsPerLookup[1][0] = benchmarkPoseSlots<std::map<long long, int, std::less<long long>, FrameAllocator<Pair>>,
+                                           FrameAllocator<Pair>>(keys, frameCount);
+    nsPerLookup[1][1] = benchmarkPoseSlots<std::unordered_map<long long, int, std::hash<long long>,
+                                           std::equal_to<long long>, FrameAllocator<Pair>>, FrameAllocator<Pair>>(keys,
+                                           frameCount);
+    nsPerLookup[1][2] = benchmarkPoseSlots<HashMap<long long, int, ArenaAllocator>, ArenaAllocator>(keys, frameCount);
+
+    log("maps, 10000 pose keys per frame: std::map %.2f ns, std::unordered_map %.2f ns, HashMap %.2f ns per lookup",
+        nsPerLookup[1][0], nsPerLookup[1][1], nsPerLookup[1][2]);
+}
+
+// the scalar code the math kernels replaced, the baseline of benchmarkMath()
+static vec4 transformScalar(const mat4& m, vec4 v)
+{
+    return {m.i.x * v.x + m.j.x * v.y + m.k.x * v.z + m.w.x * v.w,
+            m.i.y * v.x + m.j.y * v.y + m.k.y * v.z + m.w.y * v.w,
+            m.i.z * v.x + m.j.z * v.y + m.k.z * v.z + m.w.z * v.w,
+            m.i.w * v.x + m.j.w * v.y + m.k.w * v.z + m.w.w * v.w};
+}
+
+static mat4 multiplyScalar(const mat4& ml, const mat4& mr)
+{
+    mat4 m;
+
+    for(int i = 0; i < 4; ++i)
+        m[i] = transformScalar(ml, mr[i]);
+
+    return m;
+}
+
+// the largest absolute difference of the components
+static float getMaxError(const float* values, const float* references, int count)
+{
+    float maxError = 0.f;
+
+    for(int i = 0; i < count; ++i)
+        maxError = max(maxError, fabsf(values[i] - references[i]));
+
+    return maxError;
+}
+
+bool checkMathKernels(float (&maxError)[3])
+{
+    // not a multiple of the simd width, so the tails are checked too
+    const int count = 1027;
+    Array<vec3> points, translations, scales, transformed, references;
+    Array<quat> rotations;
+    Array<mat4> lhs, rhs, products, referenceProducts;
+    points.resize(count);
+    translations.resize(count);
+    scales.resize(count);
+    transformed.resize(count);
+    references.resize(count);
+    rotations.resize(count);
+    lhs.resize(count);
+    rhs.resize(count);
+    products.resize(count);
+    referenceProducts.resize(count);
+
+    auto random = [] { return rand() / float(RAND_MAX) * 2.f - 1.f; };
+
+    for(int i = 0; i < count; ++i)
+    {
+        points[i] = {random(), random(), random()};
+        translations[i] = points[i] * 100.f;
+        scales[i] = vec3(1.f + random() * 0.5f);
+        rotations[i] = normalize(quat(random(), random(), random(), random()));
+    }
+
+    for(int i = 0; i < count; ++i)
+    {
+        lhs[i] = multiplyScalar(multiplyScalar(translate(translations[i]), toMat4(rotations[i])),
+                                scale(scales[i]));
+        rhs[i] = multiplyScalar(multiplyScalar(translate(-translations[i]), toMat4(rotations[count - 1 - i])),
+                                scale(scales[i]));
+    }
+
+    const mat4 m = lhs[0];
+
+    for(int i = 0; i < count; ++i)
+        references[i] = vec3(transformScalar(m, vec4(points[i], 1.f)));
+
+    transformPoints(m, points.data(), transformed.data(), count);
+    maxError[0] = getMaxError(&transformed[0].x, &references[0].x, count * 3);
+
+    for(int i = 0; i < count; ++i)
+        referenceProducts[i] = multiplyScalar(lhs[i], rhs[i]);
+
+    // in place, as the output may alias an operand
+    memcpy(products.data(), lhs.data(), count * sizeof(mat4));
+    multiplyMatrices(products.data(), rhs.data(), products.data(), count);
+    maxError[1] = getMaxError(&products[0][0].x, &referenceProducts[0][0].x, count * 16);
+
+    composeTRS(translations.data(), rotations.data(), scales.data(), products.data(), count);
+    maxError[2] = getMaxError(&products[0][0].x, &lhs[0][0].x, count * 16);
+
+    const char* names[] = {"transform points", "multiply matrices", "compose TRS"};
+    bool passed = true;
+
+    for(int i = 0; i < getSize(names); ++i)
+    {
+        // the translations are up to 100, a few ulps of the largest components
+        const bool kernelPassed = maxError[i] < 1e-3f;
+        passed = passed && kernelPassed;
+
+        log("math, %s: max error %g against the scalar code%s", names[i], maxError[i],
+            kernelPassed ? "" : ", FAILED");
+    }
+
+    return passed;
+}
+
+bool benchmarkMath(double (&nsPerElement)[3][3], float (&maxError)[3])
+{
+    const bool passed = checkMathKernels(maxError);
+
+    const int count = 4096;
+    const int repeats = 500;
+    Array<vec3> points, translations, scales, transformed;
+    Array<quat> rotations;
+    Array<mat4> lhs, rhs, products;
+    points.resize(count);
+    translations.resize(count);
+    scales.resize(count);
+    transformed.resize(count);
+    rotations.resize(count);
+    lhs.resize(count);
+    rhs.resize(count);
+    products.resize(count);
+
+    auto random = [] { return rand() / float(RAND_MAX) * 2.f - 1.f; };
+
+    for(int i = 0; i < count; ++i)
+    {
+        points[i] = {random(), random(), random()};
+        translations[i] = points[i] * 100.f;
+        scales[i] = vec3(1.f + random() * 0.5f);
+        rotations[i] = normalize(quat(random(), random(), random(), random()));
+        lhs[i] = composeTRS(translations[i], rotations[i], scales[i]);
+        rhs[i] = composeTRS(-translations[i], rotations[count - 1 - i], scales[i]);
+    }
+
+    volatile float checksum = 0.f;
+    const mat4 m = lhs[0];
+    const double ops = double(count) * repeats;
+    double start;
+
+    auto stop = [&](double& ns)
+    {
+        ns = (getTime() - start) * 1000000000.0 / ops;
+        checksum = checksum + transformed[count / 2].x + products[count / 2].w.x;
+    };
+
+    start = getTime();
+    for(int r = 0; r < repeats; ++r)
+        for(int i = 0; i < count; ++i)
+            transformed[i] = vec3(transformScalar(m, vec4(points[i], 1.f)));
+    stop(nsPerElement[0][0]);
+
+    start = getTime();
+    for(int r = 0; r < repeats; ++r)
+        for(int i = 0; i < count; ++i)
+            transformed[i] = vec3(m * vec4(points[i], 1.f));
+    stop(nsPerElement[0][1]);
+
+    start = getTime();
+    for(int r = 0; r < repeats; ++r)
+        transformPoints(m, points.data(), transformed.data(), count);
+    stop(nsPerElement[0][2]);
+
+    start = getTime();
+    for(int r = 0; r < repeats; ++r)
+        for(int i = 0; i < count; ++i)
+            products[i] = multiplyScalar(lhs[i], rhs[i]);
+    stop(nsPerElement[1][0]);
+
+    start = getTime();
+    for(int r = 0; r < repeats; ++r)
+        for(int i = 0; i < count; ++i)
+            products[i] = lhs[i] * rhs[i];
+    stop(nsPerElement[1][1]);
+
+    start = getTime();
+    for(int r = 0; r < repeats; ++r)
+        multiplyMatrices(lhs.data(), rhs.data(), products.data(), count);
+    stop(nsPerElement[1][2]);
+
+    // the baseline is the chain of multiplications composeTRS() avoids
+    start = getTime();
+    for(int r = 0; r < repeats; ++r)
+        for(int i = 0; i < count; ++i)
+            products[i] = multiplyScalar(multiplyScalar(translate(translations[i]), toMat4(rotations[i])),
+                                         scale(scales[i]));
+    stop(nsPerElement[2][0]);
+
+    start = getTime();
+    for(int r = 0; r < repeats; ++r)
+        for(int i = 0; i < count; ++i)
+            products[i] = composeTRS(translations[i], rotations[i], scales[i]);
+    stop(nsPerElement[2][1]);
+
+    start = getTime();
+    for(int r = 0; r < repeats; ++r)
+        composeTRS(translations.data(), rotations.data(), scales.data(), products.data(), count);
+    stop(nsPerElement[2][2]);
+
+    const char* names[] = {"transform points", "multiply matrices", "compose TRS"};
+
+    for(int i = 0; i < getSize(names); ++i)
+    {
+        log("math, %s: scalar %.2f ns, per element %.2f ns, batched %.2f ns", names[i], nsPerElement[i][0],
+            nsPerElement[i][1], nsPerElement[i][2]);
+    }
+
+    return passed;
+}
+
+void benchmarkJobSystem(JobSystem& jobSystem, int jobCount, bool split, double& jobsPerSecond,
+                        double& idlePercent)
+{
+    auto empty = [](int, int) {};
+    JobCounter counter;
+
+    jobSystem.resetStats();
+    const double start = getTime();
+
+    if(split)
+        jobSystem.parallelFor(jobCount, 1, empty);
+    else
+    {
+        for(int i = 0; i < jobCount; ++i)
+            jobSystem.run({[](void*, int, int) {}, nullptr, 0, 0, &counter});
+
+        jobSystem.wait(counter);
+    }
+
+    const double seconds = getTime() - start;
+    const JobSystem::Stats stats = jobSystem.getStats();
+    const int workerCount = jobSystem.getThreadCount() - 1;
+
+    jobsPerSecond = stats.jobs / seconds;
+    idlePercent = workerCount ? stats.idleSeconds / (seconds * workerCount) * 100.0 : 0.0;
+
+    log("job system, %s: %d threads, %.2f M jobs/s, %lld steals, workers idle %.1f%%", split ? "split" : "queued",
+        jobSystem.getThreadCount(), jobsPerSecond / 1000000.0, stats.steals, idlePercent);
+}
+
+// the skeleton update before the nodes were flattened, the baseline of benchmarkSkeletonUpdate(): a tree
+// walked recursively, the channels looked up in a std::map; the keys are sampled as in updateBones()
+struct SkeletonTreeNode
+{
+    int idxNode;
+    std::vector<SkeletonTreeNode> children;
+};
+
+static void buildSkeletonTree(const Skeleton& skeleton, SkeletonTreeNode& node)
+{
+    for(int i = node.idxNode + 1; i < skeleton.nodeCount(); ++i)
+    {
+        if(skeleton.parents[i] == node.idxNode)
+        {
+            node.children.push_back({i, {}});
+            buildSkeletonTree(skeleton, node.children.back());
+        }
+    }
+}
+
+static void updateSkeletonTree(const Skeleton& skeleton, const Animation& animation,
+                               const std::map<int, int>& channels, float time, const SkeletonTreeNode& node,
+                               const mat4& parentTransform, KeyCursor* cursors, mat4* boneTransformations)
+{
+    const int i = node.idxNode;
+    mat4 transform = skeleton.localTransforms[i];
+
+    auto it = channels.find(i);
+    if(it != channels.end())
+        transform = sampleChannel(animation, it->second, time, cursors[i]);
+
+    const mat4 globalTransform = parentTransform * transform;
+
+    if(skeleton.boneIndices[i] < MAX_BONES)
+        boneTransformations[skeleton.boneIndices[i]] = globalTransform * skeleton.inverseBindTransforms[i];
+
+    for(const SkeletonTreeNode& child: node.children)
+    {
+        updateSkeletonTree(skeleton, animation, channels, time, child, globalTransform, cursors,
+                           boneTransformations);
+    }
+}
+
+void benchmarkSkeletonUpdate(JobSystem& jobSystem, const Skeleton& skeleton, int instanceCount, int frameCount,
+                             double (&msPerFrame)[2])
+{
+    const Animation& animation = skeleton.animations.front();
+    const int nodeCount = skeleton.nodeCount();
+    const float dt = 1.f / 60.f;
+    int boneCount = 0;
+
+    for(int idxBone: skeleton.boneIndices)
+    {
+        if(idxBone != MAX_BONES)
+            boneCount = max(boneCount, idxBone + 1);
+    }
+
+    std::vector<SkeletonTreeNode> roots;
+    std::map<int, int> channels;
+
+    for(int i = 0; i < nodeCount; ++i)
+    {
+        if(skeleton.parents[i] == -1)
+        {
+            roots.push_back({i, {}});
+            buildSkeletonTree(skeleton, roots.back());
+        }
+
+        if(animation.channelIndices[i] != -1)
+            channels[i] = animation.channelIndices[i];
+    }
+
+    std::vector<float> times(instanceCount);
+    std::vector<KeyCursor> cursors(instanceCount * nodeCount);
+    std::vector<mat4> nodeTransforms(instanceCount * nodeCount);
+    std::vector<mat4> boneTransformations(instanceCount * boneCount);
+
+    for(float& time: times)
+        time = randomFloat() * animation.duration;
+
+    auto updateTree = [&](int begin, int end)
+    {
+        for(int i = begin; i < end; ++i)
+        {
+            times[i] = fmod(times[i] + dt, animation.duration);
+
+            for(const SkeletonTreeNode& root: roots)
+            {
+                updateSkeletonTree(skeleton, animation, channels, times[i], root, mat4(), &cursors[i * nodeCount],
+                                   &boneTransformations[i * boneCount]);
+            }
+        }
+    };
+
+    auto update = [&](int begin, int end)
+    {
+        for(int i = begin; i < end; ++i)
+        {
+            times[i] = fmod(times[i] + dt, animation.duration);
+            updateBones(skeleton, animation, times[i], &cursors[i * nodeCount], &nodeTransforms[i * nodeCount],
+                        &boneTransformations[i * boneCount]);
+        }
+    };
+
+    double start = getTime();
+
+    for(int idxFrame = 0; idxFrame < frameCount; ++idxFrame)
+        jobSystem.parallelFor(instanceCount, 16, updateTree);
+
+    msPerFrame[0] = (getTime() - start) * 1000.0 / frameCount;
+    start = getTime();
+
+    for(int idxFrame = 0; idxFrame < frameCount; ++idxFrame)
+        jobSystem.parallelFor(instanceCount, 16, update);
+
+    msPerFrame[1] = (getTime() - start) * 1000.0 / frameCount;
+
+    log("skeleton update: %d instances, %d nodes, %d threads, recursive %.3f ms, flat %.3f ms per frame",
+        instanceCount, nodeCount, jobSystem.getThreadCount(), msPerFrame[0], msPerFrame[1]);
+}
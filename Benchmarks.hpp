@@ -0,0 +1,33 @@
+#pragma once
+
+// timings of the engine building blocks against their alternatives, run from the gui; the results
+// are logged too
+
+class JobSystem;
+struct Skeleton;
+
+// std::vector against the Array storage policies on the push heavy paths of the loader
+void benchmarkContainers(double (&nsPerPush)[3][4], long long (&heapCalls)[3][4]);
+
+// std::map and std::unordered_map against HashMap at the scale of the sponza loader and of the
+// crowd pose cache
+void benchmarkHashMaps(double (&nsPerLookup)[2][3]);
+
+// max abs errors of the batched math kernels against the scalar code, per kernel as in benchmarkMath();
+// false if any is over the tolerance
+bool checkMathKernels(float (&maxError)[3]);
+
+// ns per element of the math kernels: [kernel][scalar baseline, per element api, batched api];
+// kernels - transform points, multiply matrices, compose TRS matrices; checks the kernels first,
+// returns the result of checkMathKernels()
+bool benchmarkMath(double (&nsPerElement)[3][3], float (&maxError)[3]);
+
+// scheduling overhead, every job is empty; jobs either split from one parallelFor() range or
+// are all queued by the calling thread, so the others have to steal them
+void benchmarkJobSystem(JobSystem& jobSystem, int jobCount, bool split, double& jobsPerSecond,
+                        double& idlePercent);
+
+// every instance has its own phase and key cursors, as in the test scene; ms per frame of the
+// recursive baseline and of updateBones()
+void benchmarkSkeletonUpdate(JobSystem& jobSystem, const Skeleton& skeleton, int instanceCount, int frameCount,
+                             double (&msPerFrame)[2]);
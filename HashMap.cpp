@@ -0,0 +1,78 @@
+#include "HashMap.hpp"
+
+unsigned hashString(const char* str)
+{
+    unsigned hash = 2166136261u;
+
+    for(; *str; ++str)
+    {
+        hash ^= (unsigned char)*str;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+// the slot of the string or the empty one where it belongs
+int StringTable::findSlot(const char* str, unsigned hash) const
+{
+    const int mask = table_.size() - 1;
+    int i = hash & mask;
+
+    for(; table_[i] != -1; i = (i + 1) & mask)
+    {
+        const int id = table_[i];
+
+        if(hashes_[id] == hash && strcmp(getString(id), str) == 0)
+            break;
+    }
+
+    return i;
+}
+
+int StringTable::find(const char* str) const
+{
+    if(table_.empty())
+        return -1;
+
+    return table_[findSlot(str, hashString(str))];
+}
+
+int StringTable::intern(const char* str)
+{
+    if((offsets_.size() + 1) * 2 > table_.size())
+    {
+        const int capacity = table_.size() ? table_.size() * 2 : 64;
+        table_.resize(capacity);
+
+        for(int& id: table_)
+            id = -1;
+
+        const int mask = capacity - 1;
+
+        for(int id = 0; id < offsets_.size(); ++id)
+        {
+            int i = hashes_[id] & mask;
+
+            while(table_[i] != -1)
+                i = (i + 1) & mask;
+
+            table_[i] = id;
+        }
+    }
+
+    const unsigned hash = hashString(str);
+    const int slot = findSlot(str, hash);
+
+    if(table_[slot] != -1)
+        return table_[slot];
+
+    const int id = offsets_.size();
+    const int length = strlen(str) + 1;
+    offsets_.pushBack(chars_.size());
+    hashes_.pushBack(hash);
+    chars_.resize(chars_.size() + length);
+    memcpy(chars_.data() + offsets_.back(), str, length);
+    table_[slot] = id;
+    return id;
+}
@@ -0,0 +1,223 @@
+#pragma once
+
+#include "Array.hpp"
+
+inline unsigned hashInteger(unsigned long long x)
+{
+    // the finalizer of murmur3
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return unsigned(x);
+}
+
+inline unsigned getHash(int key) { return hashInteger(unsigned(key)); }
+inline unsigned getHash(unsigned key) { return hashInteger(key); }
+inline unsigned getHash(long long key) { return hashInteger(key); }
+inline unsigned getHash(const void* key) { return hashInteger((unsigned long long)key); }
+
+// fnv-1a
+unsigned hashString(const char* str);
+
+// open addressing with linear probing; the capacity is a power of two and at most 3/4 of it is
+// used; the hashes are kept in their own array, probing touches the keys only on a hash match
+// K needs getHash(K) and operator==
+// does not respect constructors & destructors
+template<typename K, typename V, typename Allocator = HeapAllocator>
+class HashMap
+{
+public:
+    HashMap() = default;
+    explicit HashMap(const Allocator& allocator): hashes_(allocator), slots_(allocator) {}
+    HashMap(const HashMap&) = delete;
+    HashMap& operator=(const HashMap&) = delete;
+
+    V* find(const K& key)
+    {
+        const int i = findSlot(key);
+        return i == -1 ? nullptr : &slots_[i].value;
+    }
+
+    const V* find(const K& key) const
+    {
+        const int i = findSlot(key);
+        return i == -1 ? nullptr : &slots_[i].value;
+    }
+
+    // returns the value of the key; if the key is missing it is added with value, inserted is set
+    // to whether that happened
+    V& insert(const K& key, const V& value, bool* inserted = nullptr)
+    {
+        if((size_ + 1) * 4 > hashes_.size() * 3)
+            rehash(hashes_.size() ? hashes_.size() * 2 : 16);
+
+        const unsigned hash = makeHash(key);
+        const int mask = hashes_.size() - 1;
+        int i = hash & mask;
+
+        for(; hashes_[i]; i = (i + 1) & mask)
+        {
+            if(hashes_[i] == hash && slots_[i].key == key)
+            {
+                if(inserted)
+                    *inserted = false;
+
+                return slots_[i].value;
+            }
+        }
+
+        hashes_[i] = hash;
+        slots_[i] = {key, value};
+        ++size_;
+
+        if(inserted)
+            *inserted = true;
+
+        return slots_[i].value;
+    }
+
+    bool remove(const K& key)
+    {
+        int i = findSlot(key);
+
+        if(i == -1)
+            return false;
+
+        // backward shift, moves back the following entries that are not in their ideal slots
+        const int mask = hashes_.size() - 1;
+
+        for(int k = (i + 1) & mask; hashes_[k]; k = (k + 1) & mask)
+        {
+            const int ideal = hashes_[k] & mask;
+
+            // ideal is not cyclically in (i, k]
+            if(((k - ideal) & mask) >= ((k - i) & mask))
+            {
+                hashes_[i] = hashes_[k];
+                slots_[i] = slots_[k];
+                i = k;
+            }
+        }
+
+        hashes_[i] = 0;
+        --size_;
+        return true;
+    }
+
+    // keeps the capacity
+    void clear()
+    {
+        if(size_)
+            memset(hashes_.data(), 0, hashes_.size() * sizeof(unsigned));
+
+        size_ = 0;
+    }
+
+    void reserve(int count)
+    {
+        int capacity = hashes_.size() ? hashes_.size() : 16;
+
+        while(count * 4 > capacity * 3)
+            capacity *= 2;
+
+        if(capacity != hashes_.size())
+            rehash(capacity);
+    }
+
+    int size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    // f(const K&, V&), in the slot order
+    template<typename F>
+    void forEach(F f)
+    {
+        for(int i = 0; i < hashes_.size(); ++i)
+        {
+            if(hashes_[i])
+                f(slots_[i].key, slots_[i].value);
+        }
+    }
+
+private:
+    struct Slot
+    {
+        K key;
+        V value;
+    };
+
+    Array<unsigned, Allocator> hashes_; // 0 - empty
+    Array<Slot, Allocator> slots_;
+    int size_ = 0;
+
+    static unsigned makeHash(const K& key)
+    {
+        const unsigned hash = getHash(key);
+        return hash ? hash : 1;
+    }
+
+    int findSlot(const K& key) const
+    {
+        if(!size_)
+            return -1;
+
+        const unsigned hash = makeHash(key);
+        const int mask = hashes_.size() - 1;
+
+        for(int i = hash & mask; hashes_[i]; i = (i + 1) & mask)
+        {
+            if(hashes_[i] == hash && slots_[i].key == key)
+                return i;
+        }
+
+        return -1;
+    }
+
+    void rehash(int capacity)
+    {
+        Array<unsigned, Allocator> hashes(hashes_.getAllocator());
+        Array<Slot, Allocator> slots(slots_.getAllocator());
+        hashes.resize(capacity);
+        slots.resize(capacity);
+        memset(hashes.data(), 0, capacity * sizeof(unsigned));
+
+        const int mask = capacity - 1;
+
+        for(int k = 0; k < hashes_.size(); ++k)
+        {
+            if(!hashes_[k])
+                continue;
+
+            int i = hashes_[k] & mask;
+
+            while(hashes[i])
+                i = (i + 1) & mask;
+
+            hashes[i] = hashes_[k];
+            slots[i] = slots_[k];
+        }
+
+        hashes_.swap(hashes);
+        slots_.swap(slots);
+    }
+};
+
+// every distinct string is stored once and gets a dense id in the order of interning, so the
+// strings can be the keys of a HashMap and compared as ints
+class StringTable
+{
+public:
+    int intern(const char* str);
+    int find(const char* str) const; // -1 if it was not interned
+    const char* getString(int id) const { return chars_.data() + offsets_[id]; } // valid until the next intern()
+    int size() const { return offsets_.size(); }
+
+private:
+    Array<char> chars_;
+    Array<int> offsets_; // per id
+    Array<unsigned> hashes_; // per id
+    Array<int> table_; // ids, -1 - empty; power of two, at most half full
+
+    int findSlot(const char* str, unsigned hash) const;
+};
@@ -0,0 +1,288 @@
+#include "JobSystem.hpp"
+
+#include <chrono>
+#include <assert.h>
+
+// deque of the current thread; -1 - idxExternal for the threads of attachThread()
+static thread_local const JobSystem* currentSystem = nullptr;
+static thread_local int currentIndex = 0;
+
+void JobSystem::start(int threadCount, int externalCount)
+{
+    if(threadCount < 1)
+        threadCount = 1;
+
+    if(threadCount == threadCount_ && externalCount == externalCount_)
+        return;
+
+    stop();
+    quit_ = false;
+    threadCount_ = threadCount;
+    externalCount_ = externalCount;
+
+    for(int i = 0; i < threadCount + externalCount; ++i)
+        deques_.pushBack(new WorkDeque);
+
+    currentSystem = this;
+    currentIndex = 0;
+
+    for(int i = 1; i < threadCount; ++i)
+        workers_.pushBack(new std::thread(&JobSystem::workerLoop, this, i));
+}
+
+void JobSystem::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        quit_ = true;
+    }
+
+    wakeCv_.notify_all();
+
+    for(std::thread* worker: workers_)
+    {
+        worker->join();
+        delete worker;
+    }
+
+    for(WorkDeque* deque: deques_)
+    {
+        assert(deque->top == deque->jobs.size());
+        delete deque;
+    }
+
+    workers_.clear();
+    deques_.clear();
+    queued_ = 0;
+    threadCount_ = 0;
+    externalCount_ = 0;
+}
+
+void JobSystem::attachThread(int idxExternal)
+{
+    currentSystem = this;
+    currentIndex = -1 - idxExternal;
+}
+
+bool JobCounter::isDone() const
+{
+    if(pending_.load())
+        return false;
+
+    // the thread that released the continuations is out of the counter once the lock is free
+    std::lock_guard<std::mutex> lock(mutex_);
+    return done_;
+}
+
+int JobSystem::getThreadIndex() const
+{
+    // threads that are not a part of the system share the deque of the starting thread
+    if(currentSystem != this)
+        return 0;
+
+    // an external thread keeps its deque across restarts, unless it is no longer reserved
+    if(currentIndex < 0)
+        return -1 - currentIndex < externalCount_ ? threadCount_ - 1 - currentIndex : 0;
+
+    return currentIndex;
+}
+
+void JobSystem::run(Job job, JobCounter* dependency)
+{
+    if(job.counter && job.counter->pending_.fetch_add(1) == 0)
+    {
+        std::lock_guard<std::mutex> lock(job.counter->mutex_);
+        job.counter->done_ = false;
+    }
+
+    if(dependency)
+    {
+        std::lock_guard<std::mutex> lock(dependency->mutex_);
+
+        if(dependency->pending_.load())
+        {
+            dependency->continuations_.pushBack(job);
+            return;
+        }
+    }
+
+    if(deques_.empty())
+    {
+        execute(job);
+        return;
+    }
+
+    push(job);
+}
+
+void JobSystem::push(const Job& job)
+{
+    WorkDeque& deque = *deques_[getThreadIndex()];
+
+    {
+        std::lock_guard<std::mutex> lock(deque.mutex);
+        deque.jobs.pushBack(job);
+    }
+
+    queued_.fetch_add(1);
+
+    // pairs with the check of queued_ by a worker going to sleep
+    if(sleeping_.load())
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        wakeCv_.notify_one();
+    }
+}
+
+bool JobSystem::findJob(int threadIndex, Job& job)
+{
+    if(!queued_.load())
+        return false;
+
+    {
+        WorkDeque& deque = *deques_[threadIndex];
+        std::lock_guard<std::mutex> lock(deque.mutex);
+
+        if(deque.top < deque.jobs.size())
+        {
+            job = deque.jobs.back();
+            deque.jobs.popBack();
+
+            if(deque.top == deque.jobs.size())
+            {
+                deque.jobs.clear();
+                deque.top = 0;
+            }
+
+            queued_.fetch_sub(1);
+            return true;
+        }
+    }
+
+    for(int i = 1; i < deques_.size(); ++i)
+    {
+        WorkDeque& deque = *deques_[(threadIndex + i) % deques_.size()];
+        std::lock_guard<std::mutex> lock(deque.mutex);
+
+        if(deque.top < deque.jobs.size())
+        {
+            job = deque.jobs[deque.top++];
+
+            if(deque.top == deque.jobs.size())
+            {
+                deque.jobs.clear();
+                deque.top = 0;
+            }
+
+            queued_.fetch_sub(1);
+            steals_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void JobSystem::execute(const Job& job)
+{
+    job.function(job.context, job.begin, job.end);
+    jobs_.fetch_add(1, std::memory_order_relaxed);
+
+    JobCounter* const counter = job.counter;
+
+    if(!counter || counter->pending_.fetch_sub(1) != 1)
+        return;
+
+    Array<Job> continuations;
+    {
+        std::lock_guard<std::mutex> lock(counter->mutex_);
+        continuations.swap(counter->continuations_);
+
+        // a job may have been added since the counter dropped to zero, its run() clears done_
+        // before or after this
+        counter->done_ = !counter->pending_.load();
+    }
+
+    // the counter may be destroyed by a waiting thread from here on
+
+    for(const Job& continuation: continuations)
+    {
+        if(deques_.empty())
+            execute(continuation);
+        else
+            push(continuation);
+    }
+}
+
+void JobSystem::wait(JobCounter& counter)
+{
+    const int threadIndex = getThreadIndex();
+
+    while(!counter.isDone())
+    {
+        Job job;
+
+        if(!deques_.empty() && findJob(threadIndex, job))
+            execute(job);
+        else
+            std::this_thread::yield();
+    }
+}
+
+void JobSystem::executeRange(void* context, int begin, int end)
+{
+    ParallelFor& data = *(ParallelFor*)context;
+
+    while(end - begin > data.grainSize)
+    {
+        const int middle = begin + (end - begin) / 2;
+        data.system->run({executeRange, context, middle, end, &data.counter});
+        end = middle;
+    }
+
+    data.function(data.context, begin, end);
+}
+
+void JobSystem::workerLoop(int threadIndex)
+{
+    currentSystem = this;
+    currentIndex = threadIndex;
+
+    for(;;)
+    {
+        Job job;
+
+        if(findJob(threadIndex, job))
+        {
+            execute(job);
+            continue;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        {
+            std::unique_lock<std::mutex> lock(sleepMutex_);
+            sleeping_.fetch_add(1);
+            wakeCv_.wait(lock, [this] { return quit_ || queued_.load(); });
+            sleeping_.fetch_sub(1);
+
+            if(quit_)
+                return;
+        }
+
+        const auto idle = std::chrono::steady_clock::now() - start;
+        idleMicroseconds_.fetch_add(std::chrono::duration_cast<std::chrono::microseconds>(idle).count(),
+                                    std::memory_order_relaxed);
+    }
+}
+
+JobSystem::Stats JobSystem::getStats() const
+{
+    return {jobs_.load(), steals_.load(), idleMicroseconds_.load() / 1000000.0};
+}
+
+void JobSystem::resetStats()
+{
+    jobs_ = 0;
+    steals_ = 0;
+    idleMicroseconds_ = 0;
+}
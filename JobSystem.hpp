@@ -0,0 +1,129 @@
+#pragma once
+
+#include "Array.hpp"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+using JobFunction = void(*)(void* context, int begin, int end);
+
+struct Job
+{
+    JobFunction function;
+    void* context;
+    int begin;
+    int end;
+    class JobCounter* counter; // decremented when the job is done, may be nullptr
+};
+
+// number of unfinished jobs of a group; jobs can be made to depend on it, they are queued when
+// it drops to zero; can be destroyed as soon as isDone() returns true
+class JobCounter
+{
+public:
+    bool isDone() const;
+
+private:
+    friend class JobSystem;
+
+    std::atomic<int> pending_{0};
+    mutable std::mutex mutex_;
+    bool done_ = true; // under mutex_; set after the continuations are released, cleared on 0 -> 1
+    Array<Job> continuations_;
+};
+
+// fixed set of worker threads, each with its own deque; a thread takes the newest job of its
+// own deque and steals the oldest one from the others when it runs out; the thread that
+// calls start() gets a deque too and executes jobs while it waits, as do the external threads
+// attached with attachThread(); other threads share the deque of the starting thread; jobs may
+// run and wait for other jobs
+class JobSystem
+{
+public:
+    struct Stats
+    {
+        long long jobs; // executed
+        long long steals;
+        double idleSeconds; // workers sleeping, summed over all of them
+    };
+
+    JobSystem() = default;
+    ~JobSystem() { stop(); }
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    // threadCount includes the calling thread, restarts the workers if a count changed;
+    // externalCount - deques reserved for attachThread()
+    void start(int threadCount, int externalCount = 0);
+    void stop();
+    int getThreadCount() const { return threadCount_; }
+
+    // the calling thread, not a worker, gets the external deque idxExternal (< externalCount)
+    // of this and the later starts; its jobs are not taken by the starting thread
+    void attachThread(int idxExternal);
+
+    // job.counter is incremented here; with a dependency the job is queued once the dependency is done
+    void run(Job job, JobCounter* dependency = nullptr);
+
+    // executes jobs until the counter is done
+    void wait(JobCounter& counter);
+
+    // calls function(begin, end) for ranges of [0, count) of at most grainSize elements, returns
+    // when all of them are done; ranges are split in halves on demand, so the large ones are
+    // stolen first
+    template<typename F>
+    void parallelFor(int count, int grainSize, F& function)
+    {
+        ParallelFor data = {[](void* f, int begin, int end) { (*(F*)f)(begin, end); }, &function,
+                            grainSize > 0 ? grainSize : 1, this, {}};
+
+        if(count <= 0)
+            return;
+
+        run({executeRange, &data, 0, count, &data.counter});
+        wait(data.counter);
+    }
+
+    Stats getStats() const;
+    void resetStats();
+
+private:
+    struct WorkDeque
+    {
+        std::mutex mutex;
+        Array<Job> jobs;
+        int top = 0; // the oldest job, taken by thieves; the owner takes from the back
+    };
+
+    struct ParallelFor
+    {
+        JobFunction function;
+        void* context;
+        int grainSize;
+        JobSystem* system;
+        JobCounter counter;
+    };
+
+    Array<WorkDeque*> deques_; // [0] - the thread that called start(), the external ones are last
+    int threadCount_ = 0;
+    int externalCount_ = 0;
+    Array<std::thread*> workers_;
+    std::atomic<int> queued_{0};
+    std::atomic<int> sleeping_{0};
+    std::mutex sleepMutex_;
+    std::condition_variable wakeCv_;
+    bool quit_ = false;
+
+    std::atomic<long long> jobs_{0};
+    std::atomic<long long> steals_{0};
+    std::atomic<long long> idleMicroseconds_{0};
+
+    static void executeRange(void* context, int begin, int end);
+    int getThreadIndex() const;
+    void push(const Job& job);
+    bool findJob(int threadIndex, Job& job);
+    void execute(const Job& job);
+    void workerLoop(int threadIndex);
+};
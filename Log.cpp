@@ -0,0 +1,215 @@
+#include "Log.hpp"
+#include "api.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+
+struct alignas(64) LogRecord
+{
+    // index + 1 once the text is written, -1 while it is being written (seqlock), 0 never written
+    std::atomic<long long> sequence;
+    char text[LOG_RECORD_SIZE];
+};
+
+static struct
+{
+    std::atomic<long long> head;
+    LogRecord records[LOG_RECORD_COUNT];
+} logRing;
+
+static struct
+{
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool quit;
+    FILE* file;
+    long long tail; // the next record to write
+    std::atomic<long long> dropCount;
+} logSink;
+
+static void writeRecord(long long index, const char* text, int length)
+{
+    LogRecord& record = logRing.records[index & (LOG_RECORD_COUNT - 1)];
+
+    long long sequence = record.sequence.load(std::memory_order_relaxed);
+
+    // claimed only from an earlier lap, so the sequence never goes back; if a writer that lapped
+    // the ring is still in the record or a later one got there first, this one is dropped (the
+    // sink counts it)
+    do
+    {
+        if(sequence == -1 || sequence > index)
+            return;
+    }
+    while(!record.sequence.compare_exchange_weak(sequence, -1, std::memory_order_acquire,
+                                                 std::memory_order_relaxed));
+
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(record.text, text, length);
+    record.text[length] = '\0';
+    record.sequence.store(index + 1, std::memory_order_release);
+}
+
+// a record per line, longer lines are split; returns the next record or nullptr if this is the last
+static const char* splitRecord(const char* text, int& length)
+{
+    length = 0;
+
+    while(text[length] && text[length] != '\n' && length < LOG_RECORD_SIZE - 1)
+        ++length;
+
+    if(!text[length])
+        return nullptr;
+
+    return text + length + (text[length] == '\n');
+}
+
+void log(const char* fmt, ...)
+{
+    thread_local char buf[16 * 1024];
+
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+
+    int count = 0;
+    int length;
+
+    for(const char* text = buf; text; ++count)
+        text = splitRecord(text, length);
+
+    const long long first = logRing.head.fetch_add(count, std::memory_order_relaxed);
+    const char* text = buf;
+
+    for(int i = 0; i < count; ++i)
+    {
+        const char* const next = splitRecord(text, length);
+        writeRecord(first + i, text, length);
+        text = next;
+    }
+}
+
+// 0 - copied, -1 - not written yet, 1 - overwritten by a later record
+static int copyRecord(long long index, char (&text)[LOG_RECORD_SIZE])
+{
+    const LogRecord& record = logRing.records[index & (LOG_RECORD_COUNT - 1)];
+    const long long sequence = record.sequence.load(std::memory_order_acquire);
+
+    if(sequence != index + 1)
+        return sequence > index + 1 ? 1 : -1;
+
+    memcpy(text, record.text, sizeof(text));
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    if(record.sequence.load(std::memory_order_relaxed) != index + 1)
+        return 1;
+
+    text[LOG_RECORD_SIZE - 1] = '\0';
+    return 0;
+}
+
+LogSnapshot getLogSnapshot()
+{
+    const long long end = logRing.head.load(std::memory_order_acquire);
+    return {end > LOG_RECORD_COUNT ? end - LOG_RECORD_COUNT : 0, end};
+}
+
+bool readLogRecord(long long index, char (&text)[LOG_RECORD_SIZE])
+{
+    return copyRecord(index, text) == 0;
+}
+
+long long getLogDropCount()
+{
+    return logSink.dropCount.load(std::memory_order_relaxed);
+}
+
+// returns false if it stopped on a record that is still being written
+static bool writeLogRecords()
+{
+    const LogSnapshot snapshot = getLogSnapshot();
+
+    if(logSink.tail < snapshot.begin)
+    {
+        logSink.dropCount.fetch_add(snapshot.begin - logSink.tail, std::memory_order_relaxed);
+        logSink.tail = snapshot.begin;
+    }
+
+    for(; logSink.tail < snapshot.end; ++logSink.tail)
+    {
+        char text[LOG_RECORD_SIZE];
+        const int result = copyRecord(logSink.tail, text);
+
+        // the writer is either slow or dropped the message, it is waited for until it is half
+        // the ring behind
+        if(result == -1 && snapshot.end - logSink.tail < LOG_RECORD_COUNT / 2)
+            break;
+
+        if(result != 0)
+        {
+            logSink.dropCount.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        fputs(text, logSink.file);
+        fputc('\n', logSink.file);
+    }
+
+    fflush(logSink.file);
+    return logSink.tail == snapshot.end;
+}
+
+void startLogSink(const char* filename)
+{
+    logSink.file = fopen(filename, "w");
+
+    if(!logSink.file)
+    {
+        log("fopen() failed: %s", filename);
+        return;
+    }
+
+    logSink.quit = false;
+
+    logSink.thread = std::thread([]
+    {
+        std::unique_lock<std::mutex> lock(logSink.mutex);
+
+        while(!logSink.quit)
+        {
+            lock.unlock();
+            writeLogRecords();
+            lock.lock();
+            logSink.cv.wait_for(lock, std::chrono::milliseconds(50), [] { return logSink.quit; });
+        }
+    });
+}
+
+void stopLogSink()
+{
+    if(!logSink.file)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(logSink.mutex);
+        logSink.quit = true;
+    }
+
+    logSink.cv.notify_one();
+    logSink.thread.join();
+
+    // a thread can still be in the middle of log(), give it a moment
+    for(int i = 0; i < 100 && !writeLogRecords(); ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    fclose(logSink.file);
+    logSink.file = nullptr;
+}
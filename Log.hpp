@@ -0,0 +1,31 @@
+#pragma once
+
+// log() (api.hpp) formats the message into a per thread buffer and copies it into the records
+// of a fixed size ring, a record per line; the only synchronization is an atomic increment, so it
+// never blocks and can be called from any thread; when the ring wraps the oldest records are
+// overwritten; a background thread writes the records to a file
+
+enum
+{
+    LOG_RECORD_COUNT = 1024, // power of two
+    LOG_RECORD_SIZE = 504 // with the sequence a record is 512 bytes; longer lines are split
+};
+
+// records logged before the start are written too, if they were not overwritten yet
+void startLogSink(const char* filename);
+void stopLogSink(); // writes the remaining records
+
+// the records written so far; [begin, end)
+struct LogSnapshot
+{
+    long long begin;
+    long long end;
+};
+
+LogSnapshot getLogSnapshot();
+
+// false if the record was overwritten since the snapshot was taken or is still being written
+bool readLogRecord(long long index, char (&text)[LOG_RECORD_SIZE]);
+
+// records that were overwritten before the sink got to them
+long long getLogDropCount();
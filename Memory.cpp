@@ -0,0 +1,256 @@
+#include "Memory.hpp"
+
+#include <stdlib.h>
+#include <new>
+#include <atomic>
+
+static std::atomic<long long> heapAllocations(0);
+static std::atomic<long long> heapFrees(0);
+
+HeapStats getHeapStats()
+{
+    return {heapAllocations.load(std::memory_order_relaxed), heapFrees.load(std::memory_order_relaxed)};
+}
+
+void countHeapAllocation()
+{
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+void countHeapFree()
+{
+    heapFrees.fetch_add(1, std::memory_order_relaxed);
+}
+
+void* heapAllocate(size_t size)
+{
+    countHeapAllocation();
+    return malloc(size);
+}
+
+void heapFree(void* ptr)
+{
+    if(ptr)
+        countHeapFree();
+
+    free(ptr);
+}
+
+void* operator new(size_t size)
+{
+    void* const ptr = heapAllocate(size ? size : 1);
+
+    if(!ptr)
+        abort();
+
+    return ptr;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+    heapFree(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    heapFree(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    heapFree(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept
+{
+    heapFree(ptr);
+}
+
+Arena::~Arena()
+{
+    freeBlocks();
+}
+
+void Arena::freeBlocks()
+{
+    while(blocks_)
+    {
+        Block* const next = blocks_->next;
+        heapFree(blocks_);
+        blocks_ = next;
+    }
+
+    cursor_ = nullptr;
+    end_ = nullptr;
+    capacity_ = 0;
+    blockCount_ = 0;
+}
+
+void Arena::addBlock(int minSize)
+{
+    int size = blockSize_;
+
+    while(size < minSize)
+        size *= 2;
+
+    Block* const block = (Block*)heapAllocate(sizeof(Block) + size);
+    assert(block);
+    block->next = blocks_;
+    block->size = size;
+    blocks_ = block;
+    cursor_ = (char*)(block + 1);
+    end_ = cursor_ + size;
+    capacity_ += size;
+    ++blockCount_;
+}
+
+void* Arena::allocate(int size, int alignment)
+{
+    assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+    size_t offset = -(size_t)cursor_ & (alignment - 1);
+
+    if(!cursor_ || offset + size > size_t(end_ - cursor_))
+    {
+        addBlock(size + alignment);
+        offset = -(size_t)cursor_ & (alignment - 1);
+    }
+
+    char* const ptr = cursor_ + offset;
+    cursor_ = ptr + size;
+    used_ += offset + size;
+    return ptr;
+}
+
+void Arena::reset()
+{
+    // one block large enough for everything that was allocated since the last reset
+    if(blockCount_ > 1)
+    {
+        const int size = capacity_;
+        freeBlocks();
+        addBlock(size);
+    }
+    else if(blocks_)
+    {
+        cursor_ = (char*)(blocks_ + 1);
+        end_ = cursor_ + blocks_->size;
+    }
+
+    used_ = 0;
+}
+
+static thread_local Arena frameArenas[FRAME_ARENA_COUNT];
+static thread_local int currentFrameArena = -1;
+
+void beginFrameArena()
+{
+    currentFrameArena = (currentFrameArena + 1) % FRAME_ARENA_COUNT;
+    frameArenas[currentFrameArena].reset();
+}
+
+Arena& getFrameArena()
+{
+    assert(currentFrameArena != -1); // beginFrameArena() was not called on this thread
+    return frameArenas[currentFrameArena];
+}
+
+void* HeapAllocator::reallocate(void* ptr, int, int, int capacity)
+{
+    countHeapAllocation();
+    void* const data = realloc(ptr, capacity);
+    assert(data);
+    return data;
+}
+
+void* ArenaAllocator::reallocate(void* ptr, int size, int, int capacity)
+{
+    void* const data = arena_->allocate(capacity);
+
+    if(size)
+        memcpy(data, ptr, size);
+
+    return data;
+}
+
+enum
+{
+    POOL_MIN_BLOCK_LOG2 = 6,
+    POOL_MAX_BLOCK_LOG2 = 20,
+    POOL_CLASS_COUNT = POOL_MAX_BLOCK_LOG2 - POOL_MIN_BLOCK_LOG2 + 1
+};
+
+// freed blocks, the first bytes of a block point to the next one
+static thread_local void* poolFreeLists[POOL_CLASS_COUNT];
+
+// -1 for the heap blocks
+static int getPoolClass(int size)
+{
+    int log2 = POOL_MIN_BLOCK_LOG2;
+
+    while((1 << log2) < size)
+        ++log2;
+
+    return log2 <= POOL_MAX_BLOCK_LOG2 ? log2 - POOL_MIN_BLOCK_LOG2 : -1;
+}
+
+int PoolAllocator::getCapacity(int count, int elementSize) const
+{
+    const int poolClass = getPoolClass(count * elementSize);
+
+    if(poolClass == -1)
+        return count * 2;
+
+    return (1 << (poolClass + POOL_MIN_BLOCK_LOG2)) / elementSize;
+}
+
+void* PoolAllocator::reallocate(void* ptr, int size, int oldCapacity, int capacity)
+{
+    const int poolClass = getPoolClass(capacity);
+    void* data;
+
+    if(ptr && poolClass != -1 && poolClass == getPoolClass(oldCapacity))
+        return ptr;
+
+    if(poolClass == -1)
+        data = heapAllocate(capacity);
+    else if(poolFreeLists[poolClass])
+    {
+        data = poolFreeLists[poolClass];
+        poolFreeLists[poolClass] = *(void**)data;
+    }
+    else
+        data = heapAllocate(1 << (poolClass + POOL_MIN_BLOCK_LOG2));
+
+    assert(data);
+
+    if(ptr)
+    {
+        memcpy(data, ptr, size);
+        deallocate(ptr, oldCapacity);
+    }
+
+    return data;
+}
+
+void PoolAllocator::deallocate(void* ptr, int capacity)
+{
+    if(!ptr)
+        return;
+
+    const int poolClass = getPoolClass(capacity);
+
+    if(poolClass == -1)
+    {
+        heapFree(ptr);
+        return;
+    }
+
+    *(void**)ptr = poolFreeLists[poolClass];
+    poolFreeLists[poolClass] = ptr;
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+
+// heap calls of the whole process: operator new / delete, Array and the gui
+struct HeapStats
+{
+    long long allocations; // including reallocations
+    long long frees;
+};
+
+HeapStats getHeapStats();
+void countHeapAllocation();
+void countHeapFree();
+
+// counted malloc() / free()
+void* heapAllocate(size_t size);
+void heapFree(void* ptr);
+
+// bump allocator, everything is released at once by reset(); when it runs out of space it
+// chains a new block, reset() merges the blocks, so the steady state needs no heap calls
+class Arena
+{
+public:
+    explicit Arena(int blockSize = 64 * 1024): blockSize_(blockSize) {}
+    ~Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(int size, int alignment = 16);
+    void reset();
+    int getUsed() const { return used_; } // bytes since the last reset, with the alignment padding
+    int getCapacity() const { return capacity_; }
+
+private:
+    struct Block
+    {
+        Block* next;
+        int size;
+    };
+
+    int blockSize_;
+    Block* blocks_ = nullptr; // the current one first
+    char* cursor_ = nullptr;
+    char* end_ = nullptr;
+    int used_ = 0;
+    int capacity_ = 0;
+    int blockCount_ = 0;
+
+    void addBlock(int minSize);
+    void freeBlocks();
+};
+
+// every thread that has per frame temporaries owns FRAME_ARENA_COUNT arenas, one per frame
+// in a ring; beginFrameArena() switches to the next one and resets it, so what was allocated
+// during the previous frame of the thread stays valid through the current one
+enum {FRAME_ARENA_COUNT = 2};
+
+void beginFrameArena();
+Arena& getFrameArena(); // of the current frame of the calling thread
+
+// allocator for the std containers, deallocate() is a no-op
+template<typename T>
+class FrameAllocator
+{
+public:
+    using value_type = T;
+
+    FrameAllocator(): arena_(&getFrameArena()) {}
+    explicit FrameAllocator(Arena& arena): arena_(&arena) {}
+
+    template<typename U>
+    FrameAllocator(const FrameAllocator<U>& other): arena_(other.arena_) {}
+
+    T* allocate(size_t n) { return (T*)arena_->allocate(n * sizeof(T), alignof(T)); }
+    void deallocate(T*, size_t) {}
+
+    template<typename U>
+    bool operator==(const FrameAllocator<U>& other) const { return arena_ == other.arena_; }
+
+    template<typename U>
+    bool operator!=(const FrameAllocator<U>& other) const { return arena_ != other.arena_; }
+
+private:
+    template<typename U>
+    friend class FrameAllocator;
+
+    Arena* arena_;
+};
+
+// storage policies of Array, sizes are in bytes; reallocate() keeps the first size bytes of ptr,
+// which was allocated with oldCapacity;
+// getCapacity() is the growth policy, the number of elements to grow to when count does not fit;
+// MOVABLE - the storage is outside of the array, so it can be swapped
+
+// malloc / realloc, doubles the capacity
+class HeapAllocator
+{
+public:
+    enum {MOVABLE = 1};
+
+    int getCapacity(int count, int) const { return count * 2; }
+    void* reallocate(void* ptr, int size, int oldCapacity, int capacity);
+    void deallocate(void* ptr, int) { heapFree(ptr); }
+};
+
+// bump allocations from an arena, by default the frame arena of the thread that creates the array;
+// the old storage stays in the arena until it is reset
+class ArenaAllocator
+{
+public:
+    enum {MOVABLE = 1};
+
+    ArenaAllocator(): arena_(&getFrameArena()) {}
+    explicit ArenaAllocator(Arena& arena): arena_(&arena) {}
+
+    int getCapacity(int count, int) const { return count < 8 ? 16 : count * 2; }
+    void* reallocate(void* ptr, int size, int oldCapacity, int capacity);
+    void deallocate(void*, int) {}
+
+private:
+    Arena* arena_;
+};
+
+// power of two blocks from 64 B to 1 MB with per thread free lists; blocks are recycled
+// between arrays of any type (e.g. the temporaries of the loader), larger ones go to the heap;
+// the capacity fills the whole block
+class PoolAllocator
+{
+public:
+    enum {MOVABLE = 1};
+
+    int getCapacity(int count, int elementSize) const;
+    void* reallocate(void* ptr, int size, int oldCapacity, int capacity);
+    void deallocate(void* ptr, int capacity);
+};
+
+// the first Size bytes are inside of the array, then the heap
+template<int Size, int Alignment>
+class InlineAllocator
+{
+public:
+    enum {MOVABLE = 0};
+
+    int getCapacity(int count, int elementSize) const
+    {
+        return count * elementSize <= Size ? Size / elementSize : count * 2;
+    }
+
+    void* reallocate(void* ptr, int size, int oldCapacity, int capacity)
+    {
+        if(capacity <= Size)
+            return buffer_;
+
+        if(ptr && ptr != buffer_)
+            return HeapAllocator().reallocate(ptr, size, oldCapacity, capacity);
+
+        void* const data = heapAllocate(capacity);
+        assert(data);
+        memcpy(data, buffer_, size);
+        return data;
+    }
+
+    void deallocate(void* ptr, int)
+    {
+        if(ptr != buffer_)
+            heapFree(ptr);
+    }
+
+private:
+    alignas(Alignment) char buffer_[Size];
+};
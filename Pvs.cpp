@@ -0,0 +1,494 @@
+#include "Pvs.hpp"
+#include "api.hpp"
+
+#include <string.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+// note: the build runs on worker threads, log() must not be called from there
+
+struct BvhNode
+{
+    vec3 bmin;
+    vec3 bmax;
+    int first; // leaf - first triangle, inner node - the second child (the first one follows the node)
+    int count; // 0 for inner nodes
+};
+
+struct Bvh
+{
+    Array<BvhNode> nodes;
+    Array<int> triangles;
+};
+
+static int buildBvhNode(Bvh& bvh, const vec3* vertices, const Array<vec3>& centroids, int first, int count)
+{
+    const int idxNode = bvh.nodes.size();
+    bvh.nodes.pushBack({});
+
+    vec3 bmin(INFINITY);
+    vec3 bmax(-INFINITY);
+    vec3 cmin(INFINITY);
+    vec3 cmax(-INFINITY);
+
+    for(int i = first; i < first + count; ++i)
+    {
+        const int tri = bvh.triangles[i];
+
+        for(int v = 0; v < 3; ++v)
+        {
+            const vec3 p = vertices[tri * 3 + v];
+
+            for(int k = 0; k < 3; ++k)
+            {
+                bmin[k] = min(bmin[k], p[k]);
+                bmax[k] = max(bmax[k], p[k]);
+            }
+        }
+
+        for(int k = 0; k < 3; ++k)
+        {
+            cmin[k] = min(cmin[k], centroids[tri][k]);
+            cmax[k] = max(cmax[k], centroids[tri][k]);
+        }
+    }
+
+    bvh.nodes[idxNode].bmin = bmin;
+    bvh.nodes[idxNode].bmax = bmax;
+
+    if(count <= 4)
+    {
+        bvh.nodes[idxNode].first = first;
+        bvh.nodes[idxNode].count = count;
+        return idxNode;
+    }
+
+    // median split along the longest axis of the centroid bounds
+    const vec3 extent = cmax - cmin;
+    int axis = 0;
+
+    if(extent.y > extent[axis]) axis = 1;
+    if(extent.z > extent[axis]) axis = 2;
+
+    const int mid = first + count / 2;
+    int* const tris = bvh.triangles.data();
+
+    std::nth_element(tris + first, tris + mid, tris + first + count, [&](int l, int r)
+    {
+        return centroids[l][axis] < centroids[r][axis];
+    });
+
+    buildBvhNode(bvh, vertices, centroids, first, mid - first);
+    const int second = buildBvhNode(bvh, vertices, centroids, mid, first + count - mid);
+
+    bvh.nodes[idxNode].first = second;
+    bvh.nodes[idxNode].count = 0;
+    return idxNode;
+}
+
+static void buildBvh(Bvh& bvh, const vec3* vertices, int triangleCount)
+{
+    Array<vec3> centroids;
+    centroids.resize(triangleCount);
+    bvh.triangles.resize(triangleCount);
+
+    for(int i = 0; i < triangleCount; ++i)
+    {
+        centroids[i] = (vertices[i * 3] + vertices[i * 3 + 1] + vertices[i * 3 + 2]) / 3.f;
+        bvh.triangles[i] = i;
+    }
+
+    bvh.nodes.clear();
+    bvh.nodes.reserve(triangleCount / 2 + 1);
+
+    if(triangleCount)
+        buildBvhNode(bvh, vertices, centroids, 0, triangleCount);
+}
+
+static bool intersectBox(vec3 origin, vec3 invDir, vec3 bmin, vec3 bmax, float maxT)
+{
+    float tmin = 0.f;
+    float tmax = maxT;
+
+    for(int k = 0; k < 3; ++k)
+    {
+        float t1 = (bmin[k] - origin[k]) * invDir[k];
+        float t2 = (bmax[k] - origin[k]) * invDir[k];
+        tmin = max(tmin, min(t1, t2));
+        tmax = min(tmax, max(t1, t2));
+    }
+
+    return tmin <= tmax;
+}
+
+// Moller-Trumbore; returns the distance or INFINITY
+static float intersectTriangle(vec3 origin, vec3 dir, const vec3* tri)
+{
+    const vec3 e1 = tri[1] - tri[0];
+    const vec3 e2 = tri[2] - tri[0];
+    const vec3 p = cross(dir, e2);
+    const float det = dot(e1, p);
+
+    if(fabsf(det) < 1e-8f)
+        return INFINITY;
+
+    const float invDet = 1.f / det;
+    const vec3 s = origin - tri[0];
+    const float u = dot(s, p) * invDet;
+
+    if(u < 0.f || u > 1.f)
+        return INFINITY;
+
+    const vec3 q = cross(s, e1);
+    const float v = dot(dir, q) * invDet;
+
+    if(v < 0.f || u + v > 1.f)
+        return INFINITY;
+
+    const float t = dot(e2, q) * invDet;
+    return t > 0.f ? t : INFINITY;
+}
+
+// returns the closest triangle or -1
+static int castRay(const Bvh& bvh, const vec3* vertices, vec3 origin, vec3 dir)
+{
+    if(bvh.nodes.empty())
+        return -1;
+
+    const vec3 invDir(1.f / dir.x, 1.f / dir.y, 1.f / dir.z);
+    float closest = INFINITY;
+    int hit = -1;
+
+    int stack[64];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while(stackSize)
+    {
+        const BvhNode& node = bvh.nodes[stack[--stackSize]];
+
+        if(!intersectBox(origin, invDir, node.bmin, node.bmax, closest))
+            continue;
+
+        if(node.count)
+        {
+            for(int i = node.first; i < node.first + node.count; ++i)
+            {
+                const int tri = bvh.triangles[i];
+                const float t = intersectTriangle(origin, dir, vertices + tri * 3);
+
+                if(t < closest)
+                {
+                    closest = t;
+                    hit = tri;
+                }
+            }
+        }
+        else
+        {
+            assert(stackSize + 2 <= getSize(stack));
+            stack[stackSize++] = node.first;
+            stack[stackSize++] = &node - bvh.nodes.begin() + 1;
+        }
+    }
+
+    return hit;
+}
+
+// xorshift, [0, 1)
+static float nextRandom(unsigned& state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return (state >> 8) / float(1 << 24);
+}
+
+static void castCells(const PvsBuildInput& input, const Pvs& pvs, const Bvh& bvh, std::atomic<int>& nextCell,
+                      unsigned char* cellBits)
+{
+    const int bytesPerCell = (input.instanceCount + 7) / 8;
+    const int cellCount = pvs.gridSize.x * pvs.gridSize.y * pvs.gridSize.z;
+
+    for(;;)
+    {
+        const int cell = nextCell++;
+
+        if(cell >= cellCount)
+            return;
+
+        unsigned char* const bits = cellBits + cell * bytesPerCell;
+
+        const ivec3 coord(cell % pvs.gridSize.x, (cell / pvs.gridSize.x) % pvs.gridSize.y,
+                          cell / (pvs.gridSize.x * pvs.gridSize.y));
+
+        const vec3 cellMin = pvs.gridMin + vec3(coord) * pvs.cellSize;
+        const vec3 cellMax = cellMin + vec3(pvs.cellSize);
+
+        // sampling misses small meshes, everything close to the cell is visible
+        for(int i = 0; i < input.instanceCount; ++i)
+        {
+            bool overlap = true;
+
+            for(int k = 0; k < 3; ++k)
+            {
+                overlap = overlap && input.instanceMin[i][k] <= cellMax[k] + pvs.cellSize &&
+                          input.instanceMax[i][k] >= cellMin[k] - pvs.cellSize;
+            }
+
+            if(overlap)
+                bits[i / 8] |= 1 << (i % 8);
+        }
+
+        unsigned state = cell * 2654435761u + 1u;
+
+        for(int i = 0; i < input.raysPerCell; ++i)
+        {
+            const vec3 origin = cellMin + vec3(nextRandom(state), nextRandom(state), nextRandom(state)) * pvs.cellSize;
+
+            // uniform direction on a sphere
+            const float z = 1.f - 2.f * nextRandom(state);
+            const float r = sqrtf(max(0.f, 1.f - z * z));
+            const float phi = 2.f * PI * nextRandom(state);
+            const vec3 dir(r * cosf(phi), r * sinf(phi), z);
+
+            const int tri = castRay(bvh, input.vertices, origin, dir);
+
+            if(tri != -1)
+            {
+                const int instance = input.triangleInstances[tri];
+                bits[instance / 8] |= 1 << (instance % 8);
+            }
+        }
+    }
+}
+
+void buildPvs(Pvs& pvs, const PvsBuildInput& input)
+{
+    assert(input.cellSize > 0.f);
+
+    pvs.gridMin = input.gridMin;
+    pvs.cellSize = input.cellSize;
+    pvs.instanceCount = input.instanceCount;
+
+    const vec3 extent = input.gridMax - input.gridMin;
+
+    for(int k = 0; k < 3; ++k)
+        pvs.gridSize[k] = max(1, int(ceilf(extent[k] / input.cellSize)));
+
+    const int cellCount = pvs.gridSize.x * pvs.gridSize.y * pvs.gridSize.z;
+    const int bytesPerCell = (input.instanceCount + 7) / 8;
+
+    Bvh bvh;
+    buildBvh(bvh, input.vertices, input.triangleCount);
+
+    Array<unsigned char> cellBits;
+    cellBits.resize(cellCount * bytesPerCell);
+    memset(cellBits.data(), 0, cellBits.size());
+
+    std::atomic<int> nextCell(0);
+    Array<std::thread*> threads;
+
+    for(int i = 1; i < input.threadCount; ++i)
+    {
+        threads.pushBack(new std::thread(castCells, std::cref(input), std::cref(pvs), std::cref(bvh),
+                                         std::ref(nextCell), cellBits.data()));
+    }
+
+    castCells(input, pvs, bvh, nextCell, cellBits.data());
+
+    for(std::thread* thread: threads)
+    {
+        thread->join();
+        delete thread;
+    }
+
+    // a zero byte is followed by the length of the zero run
+    pvs.cellOffsets.clear();
+    pvs.data.clear();
+
+    for(int cell = 0; cell < cellCount; ++cell)
+    {
+        pvs.cellOffsets.pushBack(pvs.data.size());
+        const unsigned char* const bits = cellBits.data() + cell * bytesPerCell;
+
+        for(int i = 0; i < bytesPerCell;)
+        {
+            if(bits[i])
+            {
+                pvs.data.pushBack(bits[i]);
+                ++i;
+                continue;
+            }
+
+            int run = 0;
+
+            while(i < bytesPerCell && !bits[i] && run < 255)
+            {
+                ++run;
+                ++i;
+            }
+
+            pvs.data.pushBack(0);
+            pvs.data.pushBack(run);
+        }
+    }
+
+    pvs.cellOffsets.pushBack(pvs.data.size());
+}
+
+int getPvsCell(const Pvs& pvs, vec3 pos)
+{
+    if(!pvs.cellOffsets.size())
+        return -1;
+
+    ivec3 coord;
+
+    for(int k = 0; k < 3; ++k)
+    {
+        const float c = floorf((pos[k] - pvs.gridMin[k]) / pvs.cellSize);
+
+        if(c < 0.f || c >= pvs.gridSize[k])
+            return -1;
+
+        coord[k] = c;
+    }
+
+    return coord.x + coord.y * pvs.gridSize.x + coord.z * pvs.gridSize.x * pvs.gridSize.y;
+}
+
+void decompressPvsCell(const Pvs& pvs, int cell, Array<unsigned char>& bits)
+{
+    const int bytesPerCell = (pvs.instanceCount + 7) / 8;
+    bits.clear();
+
+    for(int i = pvs.cellOffsets[cell]; i < pvs.cellOffsets[cell + 1]; ++i)
+    {
+        if(pvs.data[i])
+            bits.pushBack(pvs.data[i]);
+        else
+        {
+            ++i;
+            for(int run = pvs.data[i]; run; --run)
+                bits.pushBack(0);
+        }
+    }
+
+    assert(bits.size() == bytesPerCell);
+    (void)bytesPerCell;
+}
+
+static const char pvsMagic[] = "tigine pvs 1";
+
+// every cell has to decompress to exactly the bytes of its bitset without reading past its range
+static bool isPvsDataValid(const Pvs& pvs)
+{
+    const int bytesPerCell = (pvs.instanceCount + 7) / 8;
+    const int cellCount = pvs.cellOffsets.size() - 1;
+
+    if(pvs.cellOffsets[0] != 0 || pvs.cellOffsets[cellCount] != pvs.data.size())
+        return false;
+
+    for(int cell = 0; cell < cellCount; ++cell)
+    {
+        const int end = pvs.cellOffsets[cell + 1];
+
+        if(end < pvs.cellOffsets[cell])
+            return false;
+
+        int size = 0;
+
+        for(int i = pvs.cellOffsets[cell]; i < end; ++i)
+        {
+            if(pvs.data[i])
+                ++size;
+            else
+            {
+                if(++i == end)
+                    return false;
+
+                size += pvs.data[i];
+            }
+        }
+
+        if(size != bytesPerCell)
+            return false;
+    }
+
+    return true;
+}
+
+bool savePvs(const Pvs& pvs, const char* filename)
+{
+    FILE* file = fopen(filename, "wb");
+
+    if(!file)
+        return false;
+
+    const int dataSize = pvs.data.size();
+
+    fwrite(pvsMagic, sizeof pvsMagic, 1, file);
+    fwrite(&pvs.gridMin, sizeof pvs.gridMin, 1, file);
+    fwrite(&pvs.cellSize, sizeof pvs.cellSize, 1, file);
+    fwrite(&pvs.gridSize, sizeof pvs.gridSize, 1, file);
+    fwrite(&pvs.instanceCount, sizeof pvs.instanceCount, 1, file);
+    fwrite(&dataSize, sizeof dataSize, 1, file);
+    fwrite(pvs.cellOffsets.data(), sizeof(int), pvs.cellOffsets.size(), file);
+    fwrite(pvs.data.data(), 1, dataSize, file);
+
+    const bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
+
+bool loadPvs(Pvs& pvs, const char* filename)
+{
+    FILE* file = fopen(filename, "rb");
+
+    if(!file)
+        return false;
+
+    char magic[sizeof pvsMagic];
+    int dataSize = 0;
+
+    bool ok = fread(magic, sizeof magic, 1, file) == 1 && memcmp(magic, pvsMagic, sizeof magic) == 0 &&
+              fread(&pvs.gridMin, sizeof pvs.gridMin, 1, file) == 1 &&
+              fread(&pvs.cellSize, sizeof pvs.cellSize, 1, file) == 1 &&
+              fread(&pvs.gridSize, sizeof pvs.gridSize, 1, file) == 1 &&
+              fread(&pvs.instanceCount, sizeof pvs.instanceCount, 1, file) == 1 &&
+              fread(&dataSize, sizeof dataSize, 1, file) == 1;
+
+    // the sizes are checked before anything is allocated from them
+    const int maxCellCount = 1 << 24;
+    const int maxInstanceCount = 1 << 24;
+    const int maxDataSize = 1 << 30;
+
+    ok = ok && pvs.gridSize.x > 0 && pvs.gridSize.y > 0 && pvs.gridSize.z > 0 &&
+         (long long)pvs.gridSize.x * pvs.gridSize.y * pvs.gridSize.z <= maxCellCount &&
+         pvs.cellSize > 0.f && isfinite(pvs.cellSize) && isfinite(pvs.gridMin.x) && isfinite(pvs.gridMin.y) &&
+         isfinite(pvs.gridMin.z) && pvs.instanceCount >= 0 && pvs.instanceCount <= maxInstanceCount &&
+         dataSize >= 0 && dataSize <= maxDataSize;
+
+    if(ok)
+    {
+        const int cellCount = pvs.gridSize.x * pvs.gridSize.y * pvs.gridSize.z;
+        pvs.cellOffsets.resize(cellCount + 1);
+        pvs.data.resize(dataSize);
+
+        ok = fread(pvs.cellOffsets.data(), sizeof(int), cellCount + 1, file) == size_t(cellCount + 1) &&
+             fread(pvs.data.data(), 1, dataSize, file) == size_t(dataSize) && isPvsDataValid(pvs);
+    }
+
+    fclose(file);
+
+    if(!ok)
+    {
+        pvs.cellOffsets.clear();
+        pvs.data.clear();
+    }
+
+    return ok;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "Array.hpp"
+#include "math.hpp"
+
+// potentially visible set of a static scene; the walkable volume is divided into cells,
+// every cell stores a compressed bitset of the mesh instances visible from it
+struct Pvs
+{
+    vec3 gridMin;
+    float cellSize;
+    ivec3 gridSize = ivec3(0);
+    int instanceCount = 0;
+    Array<int> cellOffsets; // into data, one more than the number of cells
+    Array<unsigned char> data; // run-length encoded bitsets
+};
+
+struct PvsBuildInput
+{
+    // world space, 3 vertices per triangle
+    const vec3* vertices;
+    const int* triangleInstances;
+    int triangleCount;
+
+    // world space, axis aligned
+    const vec3* instanceMin;
+    const vec3* instanceMax;
+    int instanceCount;
+
+    vec3 gridMin;
+    vec3 gridMax;
+    float cellSize;
+    int raysPerCell;
+    int threadCount;
+};
+
+void buildPvs(Pvs& pvs, const PvsBuildInput& input);
+
+// -1 if pos is outside of the grid
+int getPvsCell(const Pvs& pvs, vec3 pos);
+
+// bits - (instanceCount + 7) / 8 bytes, bit per instance
+void decompressPvsCell(const Pvs& pvs, int cell, Array<unsigned char>& bits);
+
+bool savePvs(const Pvs& pvs, const char* filename);
+bool loadPvs(Pvs& pvs, const char* filename);
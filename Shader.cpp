@@ -90,15 +90,16 @@ static void loadFile(const char* filename, Array<char>& buf)
     buf.pushBack('\0');
 }
 
-Shader createShader(const char* vs, const char* fs)
+Shader createShader(const char* vs, const char* fs, const char* const* feedbackVaryings, int feedbackVaryingCount)
 {
     Shader shader;
 
     // just use std::string...
     {
-        const int size = strlen(fs) + 1;
+        const char* name = fs ? fs : vs;
+        const int size = strlen(name) + 1;
         shader.id = (char*)malloc(size);
-        memcpy(shader.id, fs, size);
+        memcpy(shader.id, name, size);
     }
 
     shader.programId = 0;
@@ -106,9 +107,11 @@ Shader createShader(const char* vs, const char* fs)
     Array<char> vsBuf, fsBuf;
 
     loadFile(vs, vsBuf);
-    loadFile(fs, fsBuf);
 
-    if(vsBuf.empty() || fsBuf.empty())
+    if(fs)
+        loadFile(fs, fsBuf);
+
+    if(vsBuf.empty() || (fs && fsBuf.empty()))
         return shader;
 
     const GLuint vertex = glCreateShader(GL_VERTEX_SHADER);
@@ -121,15 +124,22 @@ Shader createShader(const char* vs, const char* fs)
     const bool vertexError = isCompileError(vertex);
     if(vertexError) log("vertex shader compilation failed: %s", vs);
 
-    const GLuint fragment = glCreateShader(GL_FRAGMENT_SHADER);
+    // glDeleteShader() silently ignores 0
+    GLuint fragment = 0;
+    bool fragmentError = false;
+
+    if(fs)
     {
-        const char* buf = fsBuf.data();
-        glShaderSource(fragment, 1, &buf, nullptr);
-    }
+        fragment = glCreateShader(GL_FRAGMENT_SHADER);
+        {
+            const char* buf = fsBuf.data();
+            glShaderSource(fragment, 1, &buf, nullptr);
+        }
 
-    glCompileShader(fragment);
-    const bool fragmentError = isCompileError(fragment);
-    if(fragmentError) log("fragment shader compilation failed: %s", fs);
+        glCompileShader(fragment);
+        fragmentError = isCompileError(fragment);
+        if(fragmentError) log("fragment shader compilation failed: %s", fs);
+    }
 
     if(vertexError || fragmentError)
     {
@@ -140,10 +150,20 @@ Shader createShader(const char* vs, const char* fs)
 
     const GLuint program = glCreateProgram();
     glAttachShader(program, vertex);
-    glAttachShader(program, fragment);
+
+    if(fragment)
+        glAttachShader(program, fragment);
+
+    // must be set before linking
+    if(feedbackVaryingCount)
+        glTransformFeedbackVaryings(program, feedbackVaryingCount, feedbackVaryings, GL_INTERLEAVED_ATTRIBS);
+
     glLinkProgram(program);
     glDetachShader(program, vertex);
-    glDetachShader(program, fragment);
+
+    if(fragment)
+        glDetachShader(program, fragment);
+
     glDeleteShader(vertex);
     glDeleteShader(fragment);
 
@@ -30,6 +30,12 @@ struct Shader
             glUniform1i(getUniformLocation(id, uname, uniforms), v);
     }
 
+    void uniform2i(const char* uname, ivec2 v)
+    {
+        if(programId)
+            glUniform2i(getUniformLocation(id, uname, uniforms), v.x, v.y);
+    }
+
     void uniform1f(const char* uname, float v)
     {
         if(programId)
@@ -82,6 +88,8 @@ struct Shader
     }
 };
 
-Shader createShader(const char* vs, const char* fs);
+// fs - nullptr for a transform feedback only program; feedbackVaryings are captured interleaved
+Shader createShader(const char* vs, const char* fs, const char* const* feedbackVaryings = nullptr,
+                    int feedbackVaryingCount = 0);
 
 void deleteShader(Shader& shader);
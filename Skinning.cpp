@@ -0,0 +1,377 @@
+#include "Skinning.hpp"
+
+#include <string.h>
+#include <vector>
+
+#ifdef __SSE__
+#include <immintrin.h>
+#endif
+
+static_assert(sizeof(SkinnedVertex) == 14 * sizeof(float), "SkinnedVertex must match the static vertex layout");
+
+#ifdef __SSE__
+
+// the blended matrix is transposed from rows to columns once, then every vector is
+// transformed with 4 multiply-adds; stores are done to a local buffer with overlapping
+// writes and copied out in one piece
+
+static void skinSse(const SkinVertex* vertices, int count, const vec4* palette, SkinnedVertex* skinned)
+{
+    for(int i = 0; i < count; ++i)
+    {
+        const SkinVertex& v = vertices[i];
+        __m128 c0 = _mm_setzero_ps();
+        __m128 c1 = _mm_setzero_ps();
+        __m128 c2 = _mm_setzero_ps();
+        __m128 c3 = _mm_setzero_ps();
+
+        for(int k = 0; k < MAX_WEIGHTS; ++k)
+        {
+            const float* bone = &palette[v.boneIds[k] * 3].x;
+            const __m128 weight = _mm_set1_ps(v.boneWeights[k]);
+            c0 = _mm_add_ps(c0, _mm_mul_ps(_mm_loadu_ps(bone), weight));
+            c1 = _mm_add_ps(c1, _mm_mul_ps(_mm_loadu_ps(bone + 4), weight));
+            c2 = _mm_add_ps(c2, _mm_mul_ps(_mm_loadu_ps(bone + 8), weight));
+        }
+
+        _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+
+        auto transform = [&](vec3 d)
+        {
+            return _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(d.x)), _mm_mul_ps(c1, _mm_set1_ps(d.y))),
+                              _mm_mul_ps(c2, _mm_set1_ps(d.z)));
+        };
+
+        float out[16];
+        _mm_storeu_ps(out, _mm_add_ps(transform(v.position), c3));
+        out[3] = v.texCoord.x;
+        out[4] = v.texCoord.y;
+        _mm_storeu_ps(out + 5, transform(v.normal));
+        _mm_storeu_ps(out + 8, transform(v.tangent));
+        _mm_storeu_ps(out + 11, transform(v.bitangent));
+        memcpy(&skinned[i], out, sizeof(SkinnedVertex));
+    }
+}
+
+// columns - of the blended matrix, duplicated in both 128-bit lanes; d1 goes to the lower lane
+__attribute__((target("avx2,fma")))
+static __m256 transformPair(const __m256* columns, vec3 d1, vec3 d2, __m256 offset)
+{
+    const __m256 x = _mm256_setr_ps(d1.x, d1.x, d1.x, d1.x, d2.x, d2.x, d2.x, d2.x);
+    const __m256 y = _mm256_setr_ps(d1.y, d1.y, d1.y, d1.y, d2.y, d2.y, d2.y, d2.y);
+    const __m256 z = _mm256_setr_ps(d1.z, d1.z, d1.z, d1.z, d2.z, d2.z, d2.z, d2.z);
+    return _mm256_fmadd_ps(columns[0], x, _mm256_fmadd_ps(columns[1], y, _mm256_fmadd_ps(columns[2], z, offset)));
+}
+
+// the first two rows of a bone are blended with one 8-wide multiply-add, vectors are
+// transformed in pairs
+__attribute__((target("avx2,fma")))
+static void skinAvx2(const SkinVertex* vertices, int count, const vec4* palette, SkinnedVertex* skinned)
+{
+    const __m256 translationMask = _mm256_setr_ps(1.f, 1.f, 1.f, 1.f, 0.f, 0.f, 0.f, 0.f);
+
+    for(int i = 0; i < count; ++i)
+    {
+        const SkinVertex& v = vertices[i];
+        __m256 rows01 = _mm256_setzero_ps();
+        __m128 row2 = _mm_setzero_ps();
+
+        for(int k = 0; k < MAX_WEIGHTS; ++k)
+        {
+            const float* bone = &palette[v.boneIds[k] * 3].x;
+            rows01 = _mm256_fmadd_ps(_mm256_loadu_ps(bone), _mm256_set1_ps(v.boneWeights[k]), rows01);
+            row2 = _mm_fmadd_ps(_mm_loadu_ps(bone + 8), _mm_set1_ps(v.boneWeights[k]), row2);
+        }
+
+        __m128 c0 = _mm256_castps256_ps128(rows01);
+        __m128 c1 = _mm256_extractf128_ps(rows01, 1);
+        __m128 c2 = row2;
+        __m128 c3 = _mm_setzero_ps();
+        _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+
+        const __m256 columns[] = {
+            _mm256_insertf128_ps(_mm256_castps128_ps256(c0), c0, 1),
+            _mm256_insertf128_ps(_mm256_castps128_ps256(c1), c1, 1),
+            _mm256_insertf128_ps(_mm256_castps128_ps256(c2), c2, 1)
+        };
+
+        // the normal does not get the translation
+        const __m256 translation = _mm256_mul_ps(_mm256_insertf128_ps(_mm256_castps128_ps256(c3), c3, 1),
+                                                 translationMask);
+
+        const __m256 positionNormal = transformPair(columns, v.position, v.normal, translation);
+        const __m256 tangentBitangent = transformPair(columns, v.tangent, v.bitangent, _mm256_setzero_ps());
+
+        float out[16];
+        _mm_storeu_ps(out, _mm256_castps256_ps128(positionNormal));
+        out[3] = v.texCoord.x;
+        out[4] = v.texCoord.y;
+        _mm_storeu_ps(out + 5, _mm256_extractf128_ps(positionNormal, 1));
+        _mm_storeu_ps(out + 8, _mm256_castps256_ps128(tangentBitangent));
+        _mm_storeu_ps(out + 11, _mm256_extractf128_ps(tangentBitangent, 1));
+        memcpy(&skinned[i], out, sizeof(SkinnedVertex));
+    }
+}
+
+static bool hasAvx2()
+{
+    static const bool result = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return result;
+}
+
+#else
+
+static vec3 transform(const vec4* rows, vec3 d, float w)
+{
+    const vec4 v(d.x, d.y, d.z, w);
+    vec3 result;
+
+    for(int i = 0; i < 3; ++i)
+        result[i] = rows[i].x * v.x + rows[i].y * v.y + rows[i].z * v.z + rows[i].w * v.w;
+
+    return result;
+}
+
+static void skinScalar(const SkinVertex* vertices, int count, const vec4* palette, SkinnedVertex* skinned)
+{
+    for(int i = 0; i < count; ++i)
+    {
+        const SkinVertex& v = vertices[i];
+        vec4 rows[3] = {vec4(0.f), vec4(0.f), vec4(0.f)};
+
+        for(int k = 0; k < MAX_WEIGHTS; ++k)
+        {
+            for(int r = 0; r < 3; ++r)
+                rows[r] += palette[v.boneIds[k] * 3 + r] * v.boneWeights[k];
+        }
+
+        SkinnedVertex out;
+        out.position = transform(rows, v.position, 1.f);
+        out.texCoord = v.texCoord;
+        out.normal = transform(rows, v.normal, 0.f);
+        out.tangent = transform(rows, v.tangent, 0.f);
+        out.bitangent = transform(rows, v.bitangent, 0.f);
+        skinned[i] = out;
+    }
+}
+
+#endif
+
+void skinVertices(const SkinVertex* vertices, int count, const vec4* palette, SkinnedVertex* skinned)
+{
+#ifdef __SSE__
+    if(hasAvx2())
+        skinAvx2(vertices, count, palette, skinned);
+    else
+        skinSse(vertices, count, palette, skinned);
+#else
+    skinScalar(vertices, count, palette, skinned);
+#endif
+}
+
+const char* getSkinningIsa()
+{
+#ifdef __SSE__
+    return hasAvx2() ? "avx2" : "sse";
+#else
+    return "scalar";
+#endif
+}
+
+void computeAnimationBounds(const Skeleton& skeleton, const std::vector<int>& boneMap, const SkinMesh* meshes,
+                            int meshCount, float samplesPerSecond, Animation& animation)
+{
+    const int sampleCount = max(2, int(ceilf(animation.duration * samplesPerSecond)) + 1);
+    animation.boundsSampleCount = sampleCount;
+    animation.boundsMin.clear();
+    animation.boundsMax.clear();
+    animation.boundsTravel.assign(sampleCount * meshCount, 0.f);
+
+    std::vector<KeyCursor> cursors(skeleton.nodeCount());
+    std::vector<mat4> nodeTransforms(skeleton.nodeCount());
+    std::vector<mat4> bones(MAX_BONES);
+    std::vector<vec4> palette(boneMap.size() * 3);
+    std::vector<SkinnedVertex> skinned;
+    std::vector<std::vector<vec3>> previous(meshCount); // positions of the previous sample
+
+    for(int idxSample = 0; idxSample < sampleCount; ++idxSample)
+    {
+        const float time = idxSample * animation.duration / (sampleCount - 1);
+        updateBones(skeleton, animation, time, cursors.data(), nodeTransforms.data(), bones.data());
+        packPalette(bones.data(), boneMap.data(), boneMap.size(), SKINNING_MAT3X4, palette.data());
+
+        for(int i = 0; i < meshCount; ++i)
+        {
+            const SkinMesh& mesh = meshes[i];
+            vec3 bmin(INFINITY);
+            vec3 bmax(-INFINITY);
+
+            skinned.resize(mesh.vertexCount);
+            skinVertices(mesh.vertices, mesh.vertexCount, &palette[mesh.paletteStart * 3], skinned.data());
+
+            std::vector<vec3>& positions = previous[i];
+            float travel = 0.f;
+
+            for(int idxVertex = 0; idxVertex < mesh.vertexCount; ++idxVertex)
+            {
+                const vec3 p = skinned[idxVertex].position;
+
+                for(int k = 0; k < 3; ++k)
+                {
+                    bmin[k] = min(bmin[k], p[k]);
+                    bmax[k] = max(bmax[k], p[k]);
+                }
+
+                if(idxSample)
+                    travel = max(travel, length(p - positions[idxVertex]));
+            }
+
+            if(idxSample)
+                animation.boundsTravel[(idxSample - 1) * meshCount + i] = travel;
+
+            positions.resize(mesh.vertexCount);
+
+            for(int idxVertex = 0; idxVertex < mesh.vertexCount; ++idxVertex)
+                positions[idxVertex] = skinned[idxVertex].position;
+
+            animation.boundsMin.push_back(bmin);
+            animation.boundsMax.push_back(bmax);
+        }
+    }
+}
+
+void getAnimationBounds(const Animation& animation, int idxMesh, float time, vec3& bmin, vec3& bmax)
+{
+    const int sampleCount = animation.boundsSampleCount;
+    const int meshCount = animation.boundsMin.size() / sampleCount;
+    const int sample = time / animation.duration * (sampleCount - 1);
+    const int first = max(0, sample - 1);
+    const int last = min(sampleCount - 1, sample + 2);
+    bmin = vec3(INFINITY);
+    bmax = vec3(-INFINITY);
+    float travel = 0.f;
+
+    for(int i = first; i <= last; ++i)
+    {
+        const vec3 smin = animation.boundsMin[i * meshCount + idxMesh];
+        const vec3 smax = animation.boundsMax[i * meshCount + idxMesh];
+
+        for(int k = 0; k < 3; ++k)
+        {
+            bmin[k] = min(bmin[k], smin[k]);
+            bmax[k] = max(bmax[k], smax[k]);
+        }
+
+        if(i < last)
+            travel = max(travel, animation.boundsTravel[i * meshCount + idxMesh]);
+    }
+
+    bmin -= vec3(travel);
+    bmax += vec3(travel);
+}
+
+static float distanceToSegment(vec3 p, vec3 a, vec3 b)
+{
+    const vec3 ab = b - a;
+    const float length2 = dot(ab, ab);
+    const float t = length2 > 0.f ? min(1.f, max(0.f, dot(p - a, ab) / length2)) : 0.f;
+    return length(p - (a + ab * t));
+}
+
+// the axis goes between the two points farthest apart (approximately), the ends are pulled in
+// by the radius around the axis, then the radius is grown to contain every point
+void fitBoneCapsules(const SkinMesh& mesh, BoneCapsule* capsules)
+{
+    std::vector<vec3> points;
+
+    for(int idxBone = 0; idxBone < mesh.boneCount; ++idxBone)
+    {
+        points.clear();
+
+        for(int i = 0; i < mesh.vertexCount; ++i)
+        {
+            const SkinVertex& v = mesh.vertices[i];
+            bool weighted = false;
+
+            for(int k = 0; k < MAX_WEIGHTS; ++k)
+                weighted = weighted || (v.boneIds[k] == idxBone && v.boneWeights[k] > 0.f);
+
+            // a blended vertex joins the capsule of every bone it has a weight for, its skinned
+            // position is between the ones of these bones, so it is inside the union of the boxes
+            if(weighted)
+                points.push_back(v.position);
+        }
+
+        BoneCapsule& capsule = capsules[idxBone];
+
+        if(points.empty())
+        {
+            capsule = {vec3(0.f), vec3(0.f), -1.f};
+            continue;
+        }
+
+        vec3 p1 = points.front();
+        vec3 p2 = p1;
+
+        for(vec3 p: points)
+        {
+            if(length(p - points.front()) > length(p1 - points.front()))
+                p1 = p;
+        }
+
+        for(vec3 p: points)
+        {
+            if(length(p - p1) > length(p2 - p1))
+                p2 = p;
+        }
+
+        float radius = 0.f;
+
+        for(vec3 p: points)
+            radius = max(radius, distanceToSegment(p, p1, p2));
+
+        const float axisLength = length(p2 - p1);
+        const float inset = min(radius, axisLength * 0.5f);
+
+        if(axisLength > 0.f)
+        {
+            const vec3 dir = (p2 - p1) / axisLength;
+            p1 = p1 + dir * inset;
+            p2 = p2 - dir * inset;
+        }
+
+        radius = 0.f;
+
+        for(vec3 p: points)
+            radius = max(radius, distanceToSegment(p, p1, p2));
+
+        capsule = {p1, p2, radius};
+    }
+}
+
+void getCapsuleBounds(const BoneCapsule* capsules, const mat4* bones, const int* boneMap, int count, vec3& bmin,
+                      vec3& bmax)
+{
+    bmin = vec3(INFINITY);
+    bmax = vec3(-INFINITY);
+
+    for(int i = 0; i < count; ++i)
+    {
+        const BoneCapsule& capsule = capsules[i];
+
+        if(capsule.radius < 0.f)
+            continue;
+
+        const mat4& bone = bones[boneMap[i]];
+        const float scale = max(length(vec3(bone.i)), max(length(vec3(bone.j)), length(vec3(bone.k))));
+        const float radius = capsule.radius * scale;
+        const vec3 a = vec3(bone * vec4(capsule.a, 1.f));
+        const vec3 b = vec3(bone * vec4(capsule.b, 1.f));
+
+        for(int k = 0; k < 3; ++k)
+        {
+            bmin[k] = min(bmin[k], min(a[k], b[k]) - radius);
+            bmax[k] = max(bmax[k], max(a[k], b[k]) + radius);
+        }
+    }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "Animation.hpp"
+
+// bind pose vertex of a skinned mesh, kept in memory for the cpu skinning backend;
+// boneIds index the palette of the mesh
+struct SkinVertex
+{
+    vec3 position;
+    vec2 texCoord;
+    vec3 normal;
+    vec3 tangent;
+    vec3 bitangent;
+    int boneIds[MAX_WEIGHTS];
+    float boneWeights[MAX_WEIGHTS];
+};
+
+// vertex layout of the static meshes
+struct SkinnedVertex
+{
+    vec3 position;
+    vec2 texCoord;
+    vec3 normal;
+    vec3 tangent;
+    vec3 bitangent;
+};
+
+// palette - SKINNING_MAT3X4 texels of the mesh palette; skinned is written sequentially and
+// never read, so it may point to a mapped buffer; uses AVX2 if the cpu supports it
+void skinVertices(const SkinVertex* vertices, int count, const vec4* palette, SkinnedVertex* skinned);
+
+// instruction set used by skinVertices()
+const char* getSkinningIsa();
+
+// bind pose of a mesh of a skinned model
+struct SkinMesh
+{
+    const SkinVertex* vertices;
+    int vertexCount;
+    int paletteStart; // into the boneMap of the model
+    int boneCount;
+};
+
+// samples the model space bounds of the meshes over the clip, samplesPerSecond of the clip
+// duration; both ends of the clip are sampled; also records how far the vertices move between
+// the samples
+void computeAnimationBounds(const Skeleton& skeleton, const std::vector<int>& boneMap, const SkinMesh* meshes,
+                            int meshCount, float samplesPerSecond, Animation& animation);
+
+// union of the samples around time padded by the largest vertex travel between them; a vertex
+// between two samples stays within its travel of the line between its sampled positions unless
+// it turns by more than ~250 degrees around a bone in one sample period, so the bounds hold for
+// the poses up to one sample period away
+void getAnimationBounds(const Animation& animation, int idxMesh, float time, vec3& bmin, vec3& bmax);
+
+// bind space capsule containing the vertices influenced by a bone of the mesh palette;
+// radius < 0 - no vertices
+struct BoneCapsule
+{
+    vec3 a;
+    vec3 b;
+    float radius;
+};
+
+// capsules - mesh.boneCount elements
+void fitBoneCapsules(const SkinMesh& mesh, BoneCapsule* capsules);
+
+// conservative model space bounds of the mesh in the pose; bones - skeleton bones,
+// boneMap - palette of the mesh, count - of the palette
+void getCapsuleBounds(const BoneCapsule* capsules, const mat4* bones, const int* boneMap, int count, vec3& bmin,
+                      vec3& bmax);
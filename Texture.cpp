@@ -25,24 +25,35 @@ GLuint createDefaultTexture()
 
 GLuint createTexture(const char* filename, bool srgb)
 {
-    int width, height;
-    //stbi_set_flip_vertically_on_load(true);
-    unsigned char* const data = stbi_load(filename, &width, &height, nullptr, 4);
+    const TextureImage image = decodeTexture(filename);
 
-    if(!data)
-    {
+    if(!image.data)
         log("stbi_load() failed: %s", filename);
+
+    return createTexture(image, srgb);
+}
+
+TextureImage decodeTexture(const char* filename)
+{
+    TextureImage image = {};
+    //stbi_set_flip_vertically_on_load(true);
+    image.data = stbi_load(filename, &image.width, &image.height, nullptr, 4);
+    return image;
+}
+
+GLuint createTexture(TextureImage image, bool srgb)
+{
+    if(!image.data)
         return createDefaultTexture();
-    }
 
     GLuint id;
     glGenTextures(1, &id);
     bindTexture(id, 0);
 
-    glTexImage2D(GL_TEXTURE_2D, 0, srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8, width, height, 0,
-            GL_RGBA, GL_UNSIGNED_BYTE, data);
+    glTexImage2D(GL_TEXTURE_2D, 0, srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8, image.width, image.height, 0,
+            GL_RGBA, GL_UNSIGNED_BYTE, image.data);
 
-    stbi_image_free(data);
+    stbi_image_free(image.data);
 
     glGenerateMipmap(GL_TEXTURE_2D);
 
@@ -2,6 +2,20 @@
 
 typedef unsigned int GLuint;
 
+// rgba8, data is nullptr if the file could not be decoded
+struct TextureImage
+{
+    unsigned char* data;
+    int width;
+    int height;
+};
+
 GLuint createDefaultTexture();
 GLuint createTexture(const char* filename, bool srgb);
+
+// no gl calls, can run on any thread
+TextureImage decodeTexture(const char* filename);
+
+// frees image.data, the default texture for an image that failed to decode
+GLuint createTexture(TextureImage image, bool srgb);
 void bindTexture(GLuint texId, GLuint unit);
@@ -0,0 +1,8 @@
+#version 330
+
+out float visible;
+
+void main()
+{
+    visible = 1.0;
+}
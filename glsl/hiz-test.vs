@@ -0,0 +1,66 @@
+#version 330
+
+// one point per mesh instance; the point is rasterized (and counted by an occlusion query)
+// only if the instance passes the test
+
+layout(location = 0) in vec3 bboxMin;
+layout(location = 1) in vec3 bboxMax;
+layout(location = 2) in mat4 model;
+
+uniform mat4 viewProjection;
+uniform sampler2D samplerHiz;
+uniform sampler2D samplerVisibility; // previous frame results
+uniform ivec2 gridSize;
+// 0 - pass if visible, 1 - pass if visible and was not visible in the previous frame
+uniform int secondChance;
+
+bool isVisible()
+{
+    vec3 ndcMin = vec3(1.0);
+    vec3 ndcMax = vec3(-1.0);
+
+    for(int i = 0; i < 8; ++i)
+    {
+        vec3 corner = mix(bboxMin, bboxMax, vec3(i & 1, (i >> 1) & 1, (i >> 2) & 1));
+        vec4 clip = viewProjection * model * vec4(corner, 1.0);
+
+        // the box crosses the near plane, we can't say anything
+        if(clip.w <= 0.0)
+            return true;
+
+        vec3 ndc = clip.xyz / clip.w;
+        ndcMin = min(ndcMin, ndc);
+        ndcMax = max(ndcMax, ndc);
+    }
+
+    if(any(greaterThan(ndcMin, vec3(1.0))) || any(lessThan(ndcMax.xy, vec2(-1.0))))
+        return false;
+
+    vec2 uvMin = clamp(ndcMin.xy * 0.5 + 0.5, 0.0, 1.0);
+    vec2 uvMax = clamp(ndcMax.xy * 0.5 + 0.5, 0.0, 1.0);
+
+    // pick a level at which the screen rectangle covers at most 2x2 texels
+    vec2 size = (uvMax - uvMin) * textureSize(samplerHiz, 0);
+    float level = ceil(log2(max(max(size.x, size.y), 1.0)));
+
+    float depth = max( max(textureLod(samplerHiz, uvMin, level).r,
+                           textureLod(samplerHiz, vec2(uvMax.x, uvMin.y), level).r),
+                       max(textureLod(samplerHiz, vec2(uvMin.x, uvMax.y), level).r,
+                           textureLod(samplerHiz, uvMax, level).r) );
+
+    return ndcMin.z * 0.5 + 0.5 <= depth;
+}
+
+void main()
+{
+    ivec2 texel = ivec2(gl_VertexID % gridSize.x, gl_VertexID / gridSize.x);
+    bool pass = isVisible();
+
+    if(secondChance == 1)
+        pass = pass && texelFetch(samplerVisibility, texel, 0).r < 0.5;
+
+    if(pass)
+        gl_Position = vec4((vec2(texel) + 0.5) / vec2(gridSize) * 2.0 - 1.0, 0.0, 1.0);
+    else
+        gl_Position = vec4(-2.0, -2.0, 0.0, 1.0); // clipped
+}
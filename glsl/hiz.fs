@@ -0,0 +1,35 @@
+#version 330
+
+// builds one level of the hierarchical depth buffer; every texel stores the farthest
+// depth of the source texels it covers
+
+uniform sampler2D sampler;
+
+out float depth;
+
+float fetch(ivec2 coord)
+{
+    return texelFetch(sampler, min(coord, textureSize(sampler, 0) - 1), 0).r;
+}
+
+void main()
+{
+    ivec2 srcSize = textureSize(sampler, 0);
+    ivec2 src = ivec2(gl_FragCoord.xy) * 2;
+
+    depth = max( max(fetch(src), fetch(src + ivec2(1, 0))),
+                 max(fetch(src + ivec2(0, 1)), fetch(src + ivec2(1, 1))) );
+
+    // odd source size - the last texel must also cover the extra column / row
+    bool extraX = (srcSize.x & 1) == 1 && src.x + 3 == srcSize.x;
+    bool extraY = (srcSize.y & 1) == 1 && src.y + 3 == srcSize.y;
+
+    if(extraX)
+        depth = max(depth, max(fetch(src + ivec2(2, 0)), fetch(src + ivec2(2, 1))));
+
+    if(extraY)
+        depth = max(depth, max(fetch(src + ivec2(0, 2)), fetch(src + ivec2(1, 2))));
+
+    if(extraX && extraY)
+        depth = max(depth, fetch(src + ivec2(2, 2)));
+}
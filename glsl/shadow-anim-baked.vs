@@ -0,0 +1,39 @@
+#version 330
+
+layout(location = 0) in vec3 vertex;
+layout(location = 5) in ivec4 boneIds;
+layout(location = 6) in vec4 boneWeights;
+// per instance
+layout(location = 7) in mat4 model;
+layout(location = 11) in float time;
+
+uniform mat4 lightSpaceMatrix;
+uniform sampler2D samplerBaked;
+uniform int clipRow;
+uniform int frameCount;
+uniform float duration;
+uniform int paletteStart; // first bone of the mesh in the rows
+
+// v - texture coordinate of the frame, rows are interpolated by the sampler
+mat4 getBone(int id, float v)
+{
+    float dx = 1.0 / float(textureSize(samplerBaked, 0).x);
+    float x = (float((paletteStart + id) * 3) + 0.5) * dx;
+    vec4 row0 = texture(samplerBaked, vec2(x, v));
+    vec4 row1 = texture(samplerBaked, vec2(x + dx, v));
+    vec4 row2 = texture(samplerBaked, vec2(x + 2.0 * dx, v));
+    return transpose(mat4(row0, row1, row2, vec4(0.0, 0.0, 0.0, 1.0)));
+}
+
+void main()
+{
+    float frame = fract(time / duration) * float(frameCount);
+    float v = (float(clipRow) + frame + 0.5) / float(textureSize(samplerBaked, 0).y);
+
+    mat4 boneTransform = getBone(boneIds.x, v) * boneWeights.x;
+    boneTransform += getBone(boneIds.y, v) * boneWeights.y;
+    boneTransform += getBone(boneIds.z, v) * boneWeights.z;
+    boneTransform += getBone(boneIds.w, v) * boneWeights.w;
+
+    gl_Position = lightSpaceMatrix * model * boneTransform * vec4(vertex, 1.0);
+}
@@ -6,14 +6,65 @@ layout(location = 6) in vec4 boneWeights;
 
 uniform mat4 model;
 uniform mat4 lightSpaceMatrix;
-uniform mat4 bones[64];
+// mesh palettes of all skinned models of the frame, 3 texels per bone or 2 with dual quaternions
+uniform samplerBuffer samplerBones;
+uniform int paletteOffset; // in texels
+uniform bool dualQuaternions;
+
+// rows of the affine transformation
+mat4 getBone(int id)
+{
+    int idx = paletteOffset + id * 3;
+    return transpose(mat4(texelFetch(samplerBones, idx), texelFetch(samplerBones, idx + 1),
+                          texelFetch(samplerBones, idx + 2), vec4(0.0, 0.0, 0.0, 1.0)));
+}
+
+// real and dual part
+mat2x4 getBoneDq(int id)
+{
+    int idx = paletteOffset + id * 2;
+    return mat2x4(texelFetch(samplerBones, idx), texelFetch(samplerBones, idx + 1));
+}
+
+// dual quaternion linear blending, every quaternion is brought to the hemisphere of the first one
+mat4 blendBonesDq()
+{
+    mat2x4 dq0 = getBoneDq(boneIds.x);
+    mat2x4 dq1 = getBoneDq(boneIds.y);
+    mat2x4 dq2 = getBoneDq(boneIds.z);
+    mat2x4 dq3 = getBoneDq(boneIds.w);
+
+    mat2x4 dq = dq0 * boneWeights.x;
+    dq += dq1 * (dot(dq0[0], dq1[0]) < 0.0 ? -boneWeights.y : boneWeights.y);
+    dq += dq2 * (dot(dq0[0], dq2[0]) < 0.0 ? -boneWeights.z : boneWeights.z);
+    dq += dq3 * (dot(dq0[0], dq3[0]) < 0.0 ? -boneWeights.w : boneWeights.w);
+    dq /= length(dq[0]);
+
+    vec4 r = dq[0];
+    vec4 d = dq[1];
+    vec3 t = 2.0 * (r.w * d.xyz - d.w * r.xyz + cross(r.xyz, d.xyz));
+
+    return mat4(1.0 - 2.0 * (r.y * r.y + r.z * r.z), 2.0 * (r.x * r.y + r.z * r.w), 2.0 * (r.x * r.z - r.y * r.w), 0.0,
+                2.0 * (r.x * r.y - r.z * r.w), 1.0 - 2.0 * (r.x * r.x + r.z * r.z), 2.0 * (r.y * r.z + r.x * r.w), 0.0,
+                2.0 * (r.x * r.z + r.y * r.w), 2.0 * (r.y * r.z - r.x * r.w), 1.0 - 2.0 * (r.x * r.x + r.y * r.y), 0.0,
+                t, 1.0);
+}
+
+mat4 blendBones()
+{
+    if(dualQuaternions)
+        return blendBonesDq();
+
+    mat4 boneTransform = getBone(boneIds.x) * boneWeights.x;
+    boneTransform += getBone(boneIds.y) * boneWeights.y;
+    boneTransform += getBone(boneIds.z) * boneWeights.z;
+    boneTransform += getBone(boneIds.w) * boneWeights.w;
+    return boneTransform;
+}
 
 void main()
 {
-    mat4 boneTransform = bones[boneIds.x] * boneWeights.x;
-    boneTransform += bones[boneIds.y] * boneWeights.y;
-    boneTransform += bones[boneIds.z] * boneWeights.z;
-    boneTransform += bones[boneIds.w] * boneWeights.w;
+    mat4 boneTransform = blendBones();
 
     gl_Position = lightSpaceMatrix * model * boneTransform * vec4(vertex, 1.0);
 }
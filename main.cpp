@@ -1,12 +1,13 @@
 #include "api.hpp"
 #include "Array.hpp"
+#include "Memory.hpp"
+#include "Log.hpp"
 #include "imgui/imgui.h"
 #include "imgui/imgui_impl_glfw_gl3.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <stdarg.h>
 
 #include "glad.h"
 #include <GLFW/glfw3.h>
@@ -16,7 +17,6 @@
 
 GLFWwindow* _window; // used by Camera
 static Array<WinEvent>* _winEvents; // used by glfw callbacks
-static Array<char> _logBuf; // used by log()
 
 
 static void errorCallback(const int error, const char* const description);
@@ -31,8 +31,6 @@ static void charCallback(GLFWwindow* const window, const unsigned int codepoint)
 
 int main()
 {
-    _logBuf.pushBack('\0');
-
     glfwSetErrorCallback(errorCallback);
 
     if(!glfwInit())
@@ -66,6 +64,7 @@ int main()
         return EXIT_FAILURE;
     }
 
+    startLogSink("log.txt");
     log("tigine says hello!");
     log("gl version:  %d.%d", GLVersion.major, GLVersion.minor);
     log("gl vendor:   %s", glGetString(GL_VENDOR));
@@ -81,6 +80,9 @@ int main()
     glfwSetScrollCallback(window, scrollCallback);
     glfwSetCharCallback(window, charCallback);
 
+    // counted with the rest of the heap calls
+    ImGui::SetAllocatorFunctions([](size_t size, void*) { return heapAllocate(size); },
+                                 [](void* ptr, void*) { heapFree(ptr); });
     ImGui::CreateContext();
     ImGui_ImplGlfwGL3_Init(window, false);
     ImGui::StyleColorsDark();
@@ -205,7 +207,28 @@ int main()
 
             ImGui::Begin("log");
             {
-                ImGui::TextUnformatted(_logBuf.begin());
+                const long long dropCount = getLogDropCount();
+
+                if(dropCount)
+                    ImGui::Text("%lld lines dropped", dropCount);
+
+                // newest first, only the visible records are read
+                const LogSnapshot snapshot = getLogSnapshot();
+                ImGuiListClipper clipper(snapshot.end - snapshot.begin);
+
+                while(clipper.Step())
+                {
+                    for(int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i)
+                    {
+                        char text[LOG_RECORD_SIZE];
+
+                        if(!readLogRecord(snapshot.end - 1 - i, text))
+                            text[0] = '\0';
+
+                        ImGui::TextUnformatted(text);
+                    }
+                }
+
                 ImGui::End();
             }
         }
@@ -221,31 +244,10 @@ int main()
     ImGui_ImplGlfwGL3_Shutdown();
     ImGui::DestroyContext();
     glfwTerminate();
+    stopLogSink();
     return EXIT_SUCCESS;
 }
 
-void log(const char* fmt, ...)
-{
-    static char tempBuf[10000];
-
-    if(_logBuf.size() > 20000)
-        _logBuf.resize(20000);
-
-    va_list args;
-    va_start(args, fmt);
-    vsnprintf(tempBuf, sizeof tempBuf, fmt, args);
-    va_end(args);
-
-    int len = strlen(tempBuf);
-    tempBuf[len++] = '\n';
-
-    const int prevSize = _logBuf.size();
-    _logBuf.resize(len + prevSize);
-
-    memmove(_logBuf.begin() + len, _logBuf.begin(), prevSize);
-    memcpy(_logBuf.begin(), tempBuf, len);
-}
-
 static void errorCallback(const int error, const char* const description)
 {
     (void)error;
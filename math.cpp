@@ -0,0 +1,88 @@
+#include "math.hpp"
+
+void transformPoints(const mat4& m, const vec3* points, vec3* out, int count)
+{
+#ifdef MATH_SIMD
+    const float4 i = load4(&m.i.x);
+    const float4 j = load4(&m.j.x);
+    const float4 k = load4(&m.k.x);
+    const float4 w = load4(&m.w.x);
+
+    for(int n = 0; n < count; ++n)
+    {
+        const vec3 p = points[n];
+        float4 r = madd4(w, i, splat4(p.x));
+        r = madd4(r, j, splat4(p.y));
+        r = madd4(r, k, splat4(p.z));
+        store3(&out[n].x, r);
+    }
+#else
+    for(int n = 0; n < count; ++n)
+        out[n] = vec3(m * vec4(points[n], 1.f));
+#endif
+}
+
+void multiplyMatrices(const mat4* lhs, const mat4* rhs, mat4* out, int count)
+{
+    for(int n = 0; n < count; ++n)
+        multiply(lhs[n], rhs[n], out[n]);
+}
+
+void composeTRS(const vec3* translations, const quat* rotations, const vec3* scales, mat4* out, int count)
+{
+    int n = 0;
+
+#ifdef MATH_SIMD
+    // the quaternions are transposed so every lane works on a different matrix, the columns are
+    // transposed back
+    for(; n + 4 <= count; n += 4)
+    {
+        float4 x = load4(&rotations[n].x);
+        float4 y = load4(&rotations[n + 1].x);
+        float4 z = load4(&rotations[n + 2].x);
+        float4 w = load4(&rotations[n + 3].x);
+        transpose4(x, y, z, w);
+
+        float4 s[3];
+
+        for(int idx = 0; idx < 3; ++idx)
+        {
+            const float lanes[4] = {scales[n][idx], scales[n + 1][idx], scales[n + 2][idx], scales[n + 3][idx]};
+            s[idx] = load4(lanes);
+        }
+
+        const float4 one = splat4(1.f);
+        const float4 two = splat4(2.f);
+        const float4 xx = mul4(x, x), yy = mul4(y, y), zz = mul4(z, z);
+        const float4 xy = mul4(x, y), xz = mul4(x, z), yz = mul4(y, z);
+        const float4 wx = mul4(w, x), wy = mul4(w, y), wz = mul4(w, z);
+
+        // c[column][row], as in toMat4()
+        float4 c[3][4];
+        c[0][0] = mul4(sub4(one, mul4(two, add4(yy, zz))), s[0]);
+        c[0][1] = mul4(mul4(two, add4(xy, wz)), s[0]);
+        c[0][2] = mul4(mul4(two, sub4(xz, wy)), s[0]);
+        c[1][0] = mul4(mul4(two, sub4(xy, wz)), s[1]);
+        c[1][1] = mul4(sub4(one, mul4(two, add4(xx, zz))), s[1]);
+        c[1][2] = mul4(mul4(two, add4(yz, wx)), s[1]);
+        c[2][0] = mul4(mul4(two, add4(xz, wy)), s[2]);
+        c[2][1] = mul4(mul4(two, sub4(yz, wx)), s[2]);
+        c[2][2] = mul4(sub4(one, mul4(two, add4(xx, yy))), s[2]);
+
+        for(int column = 0; column < 3; ++column)
+        {
+            c[column][3] = splat4(0.f);
+            transpose4(c[column][0], c[column][1], c[column][2], c[column][3]);
+
+            for(int idx = 0; idx < 4; ++idx)
+                store4(&out[n + idx][column].x, c[column][idx]);
+        }
+
+        for(int idx = 0; idx < 4; ++idx)
+            out[n + idx].w = vec4(translations[n + idx], 1.f);
+    }
+#endif
+
+    for(; n < count; ++n)
+        out[n] = composeTRS(translations[n], rotations[n], scales[n]);
+}
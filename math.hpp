@@ -3,6 +3,96 @@
 #include <math.h>
 #include <assert.h>
 
+// 4 wide float vectors; the vec4 and mat4 operations and the batched routines below are written
+// on top of these, tvec4<float> keeps its layout (no alignment requirement, unaligned loads)
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#define MATH_SIMD
+
+using float4 = __m128;
+
+inline float4 load4(const float* ptr) { return _mm_loadu_ps(ptr); }
+inline void store4(float* ptr, float4 v) { _mm_storeu_ps(ptr, v); }
+inline float4 splat4(float s) { return _mm_set1_ps(s); }
+inline float4 add4(float4 a, float4 b) { return _mm_add_ps(a, b); }
+inline float4 sub4(float4 a, float4 b) { return _mm_sub_ps(a, b); }
+inline float4 mul4(float4 a, float4 b) { return _mm_mul_ps(a, b); }
+inline float4 div4(float4 a, float4 b) { return _mm_div_ps(a, b); }
+inline float4 neg4(float4 v) { return _mm_xor_ps(v, _mm_set1_ps(-0.f)); }
+inline float4 madd4(float4 a, float4 b, float4 c) { return _mm_add_ps(a, _mm_mul_ps(b, c)); } // a + b * c
+
+// x, y, z of v
+inline void store3(float* ptr, float4 v)
+{
+    _mm_storel_pi((__m64*)ptr, v);
+    _mm_store_ss(ptr + 2, _mm_movehl_ps(v, v));
+}
+
+inline void transpose4(float4& a, float4& b, float4& c, float4& d) { _MM_TRANSPOSE4_PS(a, b, c, d); }
+
+// sum of the 4 lanes
+inline float hsum4(float4 v)
+{
+    v = _mm_add_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+    v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    return _mm_cvtss_f32(v);
+}
+
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MATH_SIMD
+
+using float4 = float32x4_t;
+
+inline float4 load4(const float* ptr) { return vld1q_f32(ptr); }
+inline void store4(float* ptr, float4 v) { vst1q_f32(ptr, v); }
+inline float4 splat4(float s) { return vdupq_n_f32(s); }
+inline float4 add4(float4 a, float4 b) { return vaddq_f32(a, b); }
+inline float4 sub4(float4 a, float4 b) { return vsubq_f32(a, b); }
+inline float4 mul4(float4 a, float4 b) { return vmulq_f32(a, b); }
+inline float4 neg4(float4 v) { return vnegq_f32(v); }
+inline float4 madd4(float4 a, float4 b, float4 c) { return vmlaq_f32(a, b, c); }
+
+inline float4 div4(float4 a, float4 b)
+{
+#ifdef __aarch64__
+    return vdivq_f32(a, b);
+#else
+    // reciprocal estimate refined twice
+    float4 r = vrecpeq_f32(b);
+    r = vmulq_f32(r, vrecpsq_f32(b, r));
+    r = vmulq_f32(r, vrecpsq_f32(b, r));
+    return vmulq_f32(a, r);
+#endif
+}
+
+inline void store3(float* ptr, float4 v)
+{
+    vst1_f32(ptr, vget_low_f32(v));
+    vst1q_lane_f32(ptr + 2, v, 2);
+}
+
+inline void transpose4(float4& a, float4& b, float4& c, float4& d)
+{
+    const float32x4x2_t ab = vtrnq_f32(a, b); // a0 b0 a2 b2, a1 b1 a3 b3
+    const float32x4x2_t cd = vtrnq_f32(c, d);
+    a = vcombine_f32(vget_low_f32(ab.val[0]), vget_low_f32(cd.val[0]));
+    b = vcombine_f32(vget_low_f32(ab.val[1]), vget_low_f32(cd.val[1]));
+    c = vcombine_f32(vget_high_f32(ab.val[0]), vget_high_f32(cd.val[0]));
+    d = vcombine_f32(vget_high_f32(ab.val[1]), vget_high_f32(cd.val[1]));
+}
+
+inline float hsum4(float4 v)
+{
+#ifdef __aarch64__
+    return vaddvq_f32(v);
+#else
+    const float32x2_t sum = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+    return vget_lane_f32(vpadd_f32(sum, sum), 0);
+#endif
+}
+#endif
+
 template<typename T>
 inline T max(T a, T b) { return a > b ? a : b; }
 
@@ -66,6 +156,28 @@ inline tvec4<T> operator*(T scalar, tvec4<T> v) { return v * scalar; }
 using ivec4 = tvec4<int>;
 using vec4 = tvec4<float>;
 
+#ifdef MATH_SIMD
+inline vec4 toVec4(float4 v)
+{
+    vec4 r;
+    store4(&r.x, v);
+    return r;
+}
+
+template<> inline vec4& vec4::operator+=(vec4 v) { store4(&x, add4(load4(&x), load4(&v.x))); return *this; }
+template<> inline vec4& vec4::operator-=(vec4 v) { store4(&x, sub4(load4(&x), load4(&v.x))); return *this; }
+template<> inline vec4& vec4::operator*=(vec4 v) { store4(&x, mul4(load4(&x), load4(&v.x))); return *this; }
+template<> inline vec4& vec4::operator*=(float v) { store4(&x, mul4(load4(&x), splat4(v))); return *this; }
+template<> inline vec4& vec4::operator/=(vec4 v) { store4(&x, div4(load4(&x), load4(&v.x))); return *this; }
+
+template<> inline vec4 vec4::operator+(vec4 v) const { return toVec4(add4(load4(&x), load4(&v.x))); }
+template<> inline vec4 vec4::operator-(vec4 v) const { return toVec4(sub4(load4(&x), load4(&v.x))); }
+template<> inline vec4 vec4::operator-() const { return toVec4(neg4(load4(&x))); }
+template<> inline vec4 vec4::operator*(vec4 v) const { return toVec4(mul4(load4(&x), load4(&v.x))); }
+template<> inline vec4 vec4::operator*(float v) const { return toVec4(mul4(load4(&x), splat4(v))); }
+template<> inline vec4 vec4::operator/(vec4 v) const { return toVec4(div4(load4(&x), load4(&v.x))); }
+#endif
+
 template<typename T>
 struct tvec3
 {
@@ -278,19 +390,57 @@ struct mat4
 
 inline vec4 operator*(const mat4& m, vec4 v)
 {
+#ifdef MATH_SIMD
+    float4 r = mul4(load4(&m.i.x), splat4(v.x));
+    r = madd4(r, load4(&m.j.x), splat4(v.y));
+    r = madd4(r, load4(&m.k.x), splat4(v.z));
+    r = madd4(r, load4(&m.w.x), splat4(v.w));
+    return toVec4(r);
+#else
     return m.i * v.x + m.j * v.y + m.k * v.z + m.w * v.w;
+#endif
+}
+
+// out = ml * mr, out may alias the operands
+inline void multiply(const mat4& ml, const mat4& mr, mat4& out)
+{
+#ifdef MATH_SIMD
+    const float4 li = load4(&ml.i.x);
+    const float4 lj = load4(&ml.j.x);
+    const float4 lk = load4(&ml.k.x);
+    const float4 lw = load4(&ml.w.x);
+    float4 columns[4];
+
+    for(int idx = 0; idx < 4; ++idx)
+    {
+        const float* const r = &mr[idx].x;
+        float4 c = mul4(li, splat4(r[0]));
+        c = madd4(c, lj, splat4(r[1]));
+        c = madd4(c, lk, splat4(r[2]));
+        columns[idx] = madd4(c, lw, splat4(r[3]));
+    }
+
+    for(int idx = 0; idx < 4; ++idx)
+        store4(&out[idx].x, columns[idx]);
+#else
+    const mat4 m = {ml * mr.i, ml * mr.j, ml * mr.k, ml * mr.w};
+    out = m;
+#endif
 }
 
 inline mat4 operator*(const mat4& ml, const mat4& mr)
 {
     mat4 m;
-    m.i = ml * mr.i;
-    m.j = ml * mr.j;
-    m.k = ml * mr.k;
-    m.w = ml * mr.w;
+    multiply(ml, mr, m);
     return m;
 }
 
+// out[i] = vec3(m * vec4(points[i], 1.f)), out may alias points
+void transformPoints(const mat4& m, const vec3* points, vec3* out, int count);
+
+// out[i] = lhs[i] * rhs[i], out may alias the operands
+void multiplyMatrices(const mat4* lhs, const mat4* rhs, mat4* out, int count);
+
 inline mat4 translate(vec3 v)
 {
     mat4 m;
@@ -413,6 +563,144 @@ inline mat4 rotateX(float angle)
     return m;
 }
 
+// rotation; the memory layout is x, y, z, w
+struct quat
+{
+    quat() = default;
+    quat(float x, float y, float z, float w) : x(x), y(y), z(z), w(w) {}
+
+    float x = 0.f;
+    float y = 0.f;
+    float z = 0.f;
+    float w = 1.f;
+};
+
+inline quat operator*(quat q1, quat q2)
+{
+    return {q1.w * q2.x + q1.x * q2.w + q1.y * q2.z - q1.z * q2.y,
+            q1.w * q2.y - q1.x * q2.z + q1.y * q2.w + q1.z * q2.x,
+            q1.w * q2.z + q1.x * q2.y - q1.y * q2.x + q1.z * q2.w,
+            q1.w * q2.w - q1.x * q2.x - q1.y * q2.y - q1.z * q2.z};
+}
+
+inline float dot(quat q1, quat q2)
+{
+    return q1.x * q2.x + q1.y * q2.y + q1.z * q2.z + q1.w * q2.w;
+}
+
+inline quat normalize(quat q)
+{
+    const float inv = 1.f / sqrtf(dot(q, q));
+    return {q.x * inv, q.y * inv, q.z * inv, q.w * inv};
+}
+
+// along the shorter arc, the angular velocity is not constant; accurate enough for
+// closely spaced keys
+inline quat nlerp(quat q1, quat q2, float a)
+{
+#ifdef MATH_SIMD
+    const float4 v1 = load4(&q1.x);
+    float4 v2 = load4(&q2.x);
+
+    // negate q2 if the dot product is negative
+    v2 = mul4(v2, splat4(hsum4(mul4(v1, v2)) < 0.f ? -1.f : 1.f));
+
+    const float4 r = madd4(v1, sub4(v2, v1), splat4(a));
+
+    quat q;
+    store4(&q.x, mul4(r, splat4(1.f / sqrtf(hsum4(mul4(r, r))))));
+    return q;
+#else
+    const float sign = dot(q1, q2) < 0.f ? -1.f : 1.f;
+
+    return normalize({q1.x + (sign * q2.x - q1.x) * a,
+                      q1.y + (sign * q2.y - q1.y) * a,
+                      q1.z + (sign * q2.z - q1.z) * a,
+                      q1.w + (sign * q2.w - q1.w) * a});
+#endif
+}
+
+// along the shorter arc, constant angular velocity
+inline quat slerp(quat q1, quat q2, float a)
+{
+    float cos = dot(q1, q2);
+
+    if(cos < 0.f)
+    {
+        cos = -cos;
+        q2 = {-q2.x, -q2.y, -q2.z, -q2.w};
+    }
+
+    // sin(angle) is close to 0
+    if(cos > 0.9995f)
+        return nlerp(q1, q2, a);
+
+    const float angle = acosf(cos);
+    const float invSin = 1.f / sinf(angle);
+    const float w1 = sinf((1.f - a) * angle) * invSin;
+    const float w2 = sinf(a * angle) * invSin;
+
+    return {w1 * q1.x + w2 * q2.x, w1 * q1.y + w2 * q2.y, w1 * q1.z + w2 * q2.z, w1 * q1.w + w2 * q2.w};
+}
+
+// q must be normalized
+inline mat4 toMat4(quat q)
+{
+    const float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+    const float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+    const float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+
+    mat4 m;
+    m.i = {1.f - 2.f * (yy + zz), 2.f * (xy + wz), 2.f * (xz - wy), 0.f};
+    m.j = {2.f * (xy - wz), 1.f - 2.f * (xx + zz), 2.f * (yz + wx), 0.f};
+    m.k = {2.f * (xz + wy), 2.f * (yz - wx), 1.f - 2.f * (xx + yy), 0.f};
+    return m;
+}
+
+// the upper 3x3 of m must be a rotation
+inline quat toQuat(const mat4& m)
+{
+    const float trace = m.i.x + m.j.y + m.k.z;
+    quat q;
+
+    if(trace > 0.f)
+    {
+        const float s = 0.5f / sqrtf(trace + 1.f);
+        q = {(m.j.z - m.k.y) * s, (m.k.x - m.i.z) * s, (m.i.y - m.j.x) * s, 0.25f / s};
+    }
+    else if(m.i.x > m.j.y && m.i.x > m.k.z)
+    {
+        const float s = 2.f * sqrtf(1.f + m.i.x - m.j.y - m.k.z);
+        q = {0.25f * s, (m.j.x + m.i.y) / s, (m.k.x + m.i.z) / s, (m.j.z - m.k.y) / s};
+    }
+    else if(m.j.y > m.k.z)
+    {
+        const float s = 2.f * sqrtf(1.f + m.j.y - m.i.x - m.k.z);
+        q = {(m.j.x + m.i.y) / s, 0.25f * s, (m.k.y + m.j.z) / s, (m.k.x - m.i.z) / s};
+    }
+    else
+    {
+        const float s = 2.f * sqrtf(1.f + m.k.z - m.i.x - m.j.y);
+        q = {(m.k.x + m.i.z) / s, (m.k.y + m.j.z) / s, 0.25f * s, (m.i.y - m.j.x) / s};
+    }
+
+    return normalize(q);
+}
+
+// translate(translation) * toMat4(rotation) * scale(scale) without the matrix multiplications
+inline mat4 composeTRS(vec3 translation, quat rotation, vec3 scale)
+{
+    mat4 m = toMat4(rotation);
+    m.i *= scale.x;
+    m.j *= scale.y;
+    m.k *= scale.z;
+    m.w = vec4(translation, 1.f);
+    return m;
+}
+
+// out[i] = composeTRS(translations[i], rotations[i], scales[i]); four matrices at a time
+void composeTRS(const vec3* translations, const quat* rotations, const vec3* scales, mat4* out, int count);
+
 struct Plane
 {
     vec3 position;
@@ -502,18 +790,26 @@ struct BoundingBox
     vec3 vertices[8];
 };
 
+// vertices[0] - min, vertices[7] - max
+inline BoundingBox makeBoundingBox(vec3 bmin, vec3 bmax)
+{
+    return {{ {bmin.x, bmin.y, bmin.z}, {bmax.x, bmin.y, bmin.z}, {bmin.x, bmax.y, bmin.z}, {bmax.x, bmax.y, bmin.z},
+              {bmin.x, bmin.y, bmax.z}, {bmax.x, bmin.y, bmax.z}, {bmin.x, bmax.y, bmax.z}, {bmax.x, bmax.y, bmax.z} }};
+}
+
 // http://cgvr.informatik.uni-bremen.de/teaching/cg_literatur/lighthouse3d_view_frustum_culling/index.html
 // we do are not doing 'full-testing', some objects that lay outside of frustum may be issued to a gpu
 
 inline bool cull(const Frustum& frustum, const BoundingBox& bbox, const mat4& transform)
 {
+    vec3 points[8];
+    transformPoints(transform, bbox.vertices, points, 8);
+
     for(const Plane& plane: frustum.planes)
     {
         bool in = false;
-        for(vec3 p: bbox.vertices)
+        for(vec3 p: points)
         {
-            p = vec3(transform * vec4(p, 1.f));
-
             if(dot(plane.normal, p - plane.position) > 0.f)
             {
                 in = true;
@@ -527,3 +823,116 @@ inline bool cull(const Frustum& frustum, const BoundingBox& bbox, const mat4& tr
 
     return false;
 }
+
+// per box data for temporally coherent culling
+struct CullCache
+{
+    int lastPlane = 0; // plane that culled the box the last time, it is tested first
+    int insideMask = 0; // planes that have the whole box on the positive side
+};
+
+// the same as above but the box is transformed only once and the results of the previous test are
+// reused; skipInside - the planes from cache.insideMask are not tested (the frustum barely moved
+// since they were recorded), skipping a plane can only make the test more conservative
+inline bool cull(const Frustum& frustum, const BoundingBox& bbox, const mat4& transform, CullCache& cache,
+                 bool skipInside)
+{
+    vec3 points[8];
+    transformPoints(transform, bbox.vertices, points, 8);
+
+    if(!skipInside)
+        cache.insideMask = 0;
+
+    for(int n = 0; n < PLANE_COUNT; ++n)
+    {
+        const int idxPlane = (cache.lastPlane + n) % PLANE_COUNT;
+        const int bit = 1 << idxPlane;
+
+        if(skipInside && (cache.insideMask & bit))
+            continue;
+
+        const Plane& plane = frustum.planes[idxPlane];
+        int in = 0;
+
+        for(vec3 p: points)
+            in += dot(plane.normal, p - plane.position) > 0.f;
+
+        if(!in)
+        {
+            cache.lastPlane = idxPlane;
+            return true;
+        }
+
+        if(in == 8)
+            cache.insideMask |= bit;
+    }
+
+    return false;
+}
+
+// all planes of the frustums are within the given bounds
+inline bool isNear(const Frustum& f1, const Frustum& f2, float maxShift, float minCos)
+{
+    for(int i = 0; i < PLANE_COUNT; ++i)
+    {
+        const Plane& p1 = f1.planes[i];
+        const Plane& p2 = f2.planes[i];
+
+        if(length(p1.position - p2.position) > maxShift || dot(p1.normal, p2.normal) < minCos)
+            return false;
+    }
+
+    return true;
+}
+
+// point inside of the world space bounding box of transformed bbox enlarged by margin
+inline bool isInside(vec3 point, const BoundingBox& bbox, const mat4& transform, float margin)
+{
+    vec3 bmin(INFINITY);
+    vec3 bmax(-INFINITY);
+    vec3 points[8];
+    transformPoints(transform, bbox.vertices, points, 8);
+
+    for(vec3 p: points)
+    {
+        for(int i = 0; i < 3; ++i)
+        {
+            bmin[i] = min(bmin[i], p[i]);
+            bmax[i] = max(bmax[i], p[i]);
+        }
+    }
+
+    for(int i = 0; i < 3; ++i)
+    {
+        if(point[i] < bmin[i] - margin || point[i] > bmax[i] + margin)
+            return false;
+    }
+
+    return true;
+}
+
+// approximate area in pixels covered by the transformed bbox, mvp - to clip space;
+// a box crossing the near plane is treated as covering everything
+inline float projectedArea(const BoundingBox& bbox, const mat4& mvp, vec2 viewportSize)
+{
+    vec2 ndcMin(INFINITY);
+    vec2 ndcMax(-INFINITY);
+
+    for(vec3 p: bbox.vertices)
+    {
+        const vec4 clip = mvp * vec4(p, 1.f);
+
+        if(clip.w <= 0.f)
+            return INFINITY;
+
+        const vec2 ndc = vec2(clip) / clip.w;
+        ndcMin = vec2(min(ndcMin.x, ndc.x), min(ndcMin.y, ndc.y));
+        ndcMax = vec2(max(ndcMax.x, ndc.x), max(ndcMax.y, ndc.y));
+    }
+
+    ndcMin = vec2(max(ndcMin.x, -1.f), max(ndcMin.y, -1.f));
+    ndcMax = vec2(min(ndcMax.x, 1.f), min(ndcMax.y, 1.f));
+
+    const vec2 size = (ndcMax - ndcMin) * 0.5f * viewportSize;
+    return max(size.x, 0.f) * max(size.y, 0.f);
+}
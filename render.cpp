@@ -6,11 +6,21 @@
 #include "imgui/imgui.h"
 #include "Camera.hpp"
 #include "Shader.hpp"
+#include "Pvs.hpp"
+#include "Animation.hpp"
+#include "Skinning.hpp"
+#include "JobSystem.hpp"
+#include "Memory.hpp"
+#include "HashMap.hpp"
+#include "Benchmarks.hpp"
 
 #include <assert.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <time.h>
 
+#include <GLFW/glfw3.h>
+
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
@@ -18,203 +28,15 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 static float randomFloat()
 {
     return rand() / float(RAND_MAX);
 }
 
-enum
-{
-    MAX_WEIGHTS = 4,
-    MAX_BONES = 64
-};
-
-struct PositionKey
-{
-    // transformation relative to parent bone
-    vec3 position;
-    float timestamp;
-};
-
-struct RotationKey
-{
-    vec4 rotation;
-    float timestamp;
-};
-
-struct ScaleKey
-{
-    vec3 scale;
-    float timestamp;
-};
-
-struct BoneKeys
-{
-    std::vector<PositionKey> positionKeys;
-    std::vector<RotationKey> rotationKeys;
-    std::vector<ScaleKey> scaleKeys;
-};
-
-struct Animation
-{
-    std::string name;
-    float duration;
-    std::map<int, BoneKeys> boneKeys;
-};
-
-struct Bone
-{
-    int idx = MAX_BONES; // MAX_BONES - does not affect any vertices
-    std::vector<Bone> children;
-
-    union
-    {
-        // when a bone is not animated it is used as replacement for interpolated transformation;
-        // relative to parent bone
-        mat4 transform;
-
-        mat4 transformFromMeshToBoneSpace;
-    };
-};
-
-struct Skeleton
-{
-    std::vector<Animation> animations;
-    Bone rootBone;
-};
-
-static mat4 interpolateTranslation(const std::vector<PositionKey>& keys, float time)
-{
-    vec3 translation;
-
-    if(keys.size() == 1)
-        translation = keys.front().position;
-    else
-    {
-        int currentKeyIdx = -1;
-
-        for(int i = 0; i < keys.size() - 1; ++i)
-        {
-            if(time < keys[i + 1].timestamp)
-            {
-                currentKeyIdx = i;
-                break;
-            }
-        }
-
-        assert(currentKeyIdx != -1);
-
-        PositionKey currentKey = keys[currentKeyIdx];
-        PositionKey nextKey = keys[currentKeyIdx + 1];
-
-        vec3 start = currentKey.position;
-        vec3 end = nextKey.position;
-        float transition = (time - currentKey.timestamp) / (nextKey.timestamp - currentKey.timestamp);
-        translation = start + transition * (end - start);
-    }
-
-    return translate(translation);
-}
-
-// todo: replace aiQuaternion with own quaternion code
-static mat4 interpolateRotation(const std::vector<RotationKey>& keys, float time)
-{
-    vec4 rotation;
-
-    if(keys.size() == 1)
-        rotation = keys.front().rotation;
-    else
-    {
-        int currentKeyIdx = -1;
-
-        for(int i = 0; i < keys.size() - 1; ++i)
-        {
-            if(time < keys[i + 1].timestamp)
-            {
-                currentKeyIdx = i;
-                break;
-            }
-        }
-
-        assert(currentKeyIdx != -1);
-
-        RotationKey currentKey = keys[currentKeyIdx];
-        RotationKey nextKey = keys[currentKeyIdx + 1];
-
-        vec4 start = currentKey.rotation;
-        vec4 end = nextKey.rotation;
-        float transition = (time - currentKey.timestamp) / (nextKey.timestamp - currentKey.timestamp);
-        aiQuaternion aistart = {start.w, start.x, start.y, start.z};
-        aiQuaternion aiend = {end.w, end.x, end.y, end.z};
-        aiQuaternion airesult;
-        aiQuaternion::Interpolate(airesult, aistart, aiend, transition);
-        rotation = {airesult.x, airesult.y, airesult.z, airesult.w};
-    }
-
-    aiQuaternion aiq = {rotation.w, rotation.x, rotation.y, rotation.z};
-    aiMatrix4x4 aimat(aiq.GetMatrix());
-    mat4 mat;
-    memcpy(&mat[0][0], &aimat[0][0], sizeof(mat));
-    return transpose(mat);
-}
-
-static mat4 interpolateScale(const std::vector<ScaleKey>& keys, float time)
-{
-    vec3 scale;
-
-    if(keys.size() == 1)
-        scale = keys.front().scale;
-    else
-    {
-        int currentKeyIdx = -1;
-
-        for(int i = 0; i < keys.size() - 1; ++i)
-        {
-            if(time < keys[i + 1].timestamp)
-            {
-                currentKeyIdx = i;
-                break;
-            }
-        }
-
-        assert(currentKeyIdx != -1);
-
-        ScaleKey currentKey = keys[currentKeyIdx];
-        ScaleKey nextKey = keys[currentKeyIdx + 1];
-
-        vec3 start = currentKey.scale;
-        vec3 end = nextKey.scale;
-        float transition = (time - currentKey.timestamp) / (nextKey.timestamp - currentKey.timestamp);
-        scale = start + transition * (end - start);
-    }
-
-    return ::scale(scale);
-}
-
-static void updateBones(const Animation& animation, float time, const Bone& bone, mat4 parentTransform, mat4* boneTransformations)
-{
-    mat4 transform = bone.transform;
-
-    auto it = animation.boneKeys.find(bone.idx);
-    if(it != animation.boneKeys.end())
-    {
-        mat4 scale = interpolateScale(it->second.scaleKeys, time);
-        mat4 rotation = interpolateRotation(it->second.rotationKeys, time);
-        mat4 translation = interpolateTranslation(it->second.positionKeys, time);
-
-        transform = translation * rotation * scale;
-    }
-
-    mat4 globalTransform = parentTransform * transform;
-
-    if(bone.idx < MAX_BONES)
-        boneTransformations[bone.idx] = globalTransform * bone.transformFromMeshToBoneSpace;
-
-    for(const Bone& child: bone.children)
-        updateBones(animation, time, child, globalTransform, boneTransformations);
-}
-
 struct Mesh
 {
     BoundingBox bbox;
@@ -223,6 +45,12 @@ struct Mesh
     int numIndices;
     int indicesOffset = 0;
     int idxMaterial = 0;
+    int paletteStart = 0; // first bone of the mesh in Model::boneMap
+    int boneCount = 0; // of the mesh palette
+    int vertexCount = 0;
+    int skinnedStart = 0; // first vertex of the mesh in the skinned vertices of its model
+    GLuint skinnedVao = 0; // sources the skinning pre-pass output, indices of bo
+    int bindVertexOffset = 0; // meshes of skinned models only
 };
 
 struct Model
@@ -233,8 +61,60 @@ struct Model
 
     int idxSkeleton = 0;
     float animationTime = 0.f;
+    float animationPhase = 0.f; // [0, 1), offset of the clip time as a fraction of its duration
     int currentAnimation = 0;
-    std::vector<mat4> boneTransformations;
+    int boneCount = 0;
+    std::vector<int> boneMap; // palettes of the meshes, local bone -> skeleton bone
+    int paletteOffset = 0; // in the frame palette buffer, in texels; may be shared with other models
+    int paletteFrame = -1; // the frame paletteOffset is valid for
+    int skinnedVertexCount = 0;
+    std::vector<BoneCapsule> boneCapsules; // one per boneMap element
+    float poseTime = 0.f; // clip time of the pose, known before culling; quantized with the pose cache
+    int poseOwner = -1; // in poseCache.owners of the current frame
+    std::vector<BoundingBox> meshBounds; // skinned models only, of the current pose
+    int skinnedOffset = 0; // in the skinned vertex buffer, in vertices; shared with the models sharing the palette
+    std::vector<mat4> nodeTransforms;
+    std::vector<KeyCursor> keyCursors;
+};
+
+// vertices of a mesh skinned on the cpu by one task
+struct SkinningJob
+{
+    const SkinVertex* vertices;
+    int count;
+    const vec4* palette;
+    int first; // in the skinned vertex buffer
+};
+
+// model evaluating a pose for itself and all the models sharing it
+struct PoseOwner
+{
+    int idxModel;
+    float time;
+    int poseOffset; // skeleton bones, in matrices
+    int paletteOffset; // packed mesh palettes, in texels
+    bool reduced; // level of detail
+};
+
+// hardware occlusion queries of one pass, one per mesh instance
+struct QueryPool
+{
+    // ping-pong between frames
+    Array<GLuint> queries[2];
+    // query issued for a mesh instance or 0; used as a draw condition in the next frame
+    Array<GLuint> predicates[2];
+
+    // stats of the previous frame
+    int conditional = 0;
+    int skipped = 0;
+};
+
+// input of the hi-z occlusion test, one per mesh instance (model, mesh)
+struct HizInstance
+{
+    vec3 bboxMin;
+    vec3 bboxMax;
+    mat4 model;
 };
 
 enum
@@ -247,7 +127,11 @@ enum
     UNIT_SHADOW_MAP,
     UNIT_POSITION,
     UNIT_SSAO,
-    UNIT_SSAO_NOISE
+    UNIT_SSAO_NOISE,
+    UNIT_HIZ,
+    UNIT_VISIBILITY,
+    UNIT_BAKED_ANIMATION,
+    UNIT_BONES
 };
 
 enum
@@ -264,6 +148,22 @@ enum
     VIEW_COUNT
 };
 
+enum
+{
+    OCCLUSION_OFF,
+    OCCLUSION_HIZ,
+    OCCLUSION_QUERIES,
+    OCCLUSION_COUNT
+};
+
+enum
+{
+    SKINNING_BACKEND_SHADER, // anim.vs and shadow-anim.vs skin in every pass
+    SKINNING_BACKEND_TRANSFORM_FEEDBACK, // pre-pass, once per frame
+    SKINNING_BACKEND_CPU, // worker threads, SIMD; the pre-pass output is written from the cpu
+    SKINNING_BACKEND_COUNT
+};
+
 enum
 {
     DEBUG_CAMERA_OFF,
@@ -286,33 +186,219 @@ struct Material
 
 struct TexId
 {
-    char* filename;
+    int filename; // into TexIds::filenames
     bool srgb;
 };
 
+struct TexIds
+{
+    StringTable filenames;
+    HashMap<int, int> indices; // filename * 2 + srgb -> into textures
+    Array<TexId> ids; // per texture
+};
+
 static void loadModel(const char* filename, std::vector<Model>& models, Array<Mesh>& meshes,
-                      std::vector<Skeleton>& skeletons, Array<Material>& materials,
-                      Array<GLuint>& textures, Array<TexId>& texIds);
+                      Array<SkinVertex>& bindVertices, std::vector<Skeleton>& skeletons, Array<Material>& materials,
+                      Array<GLuint>& textures, TexIds& texIds);
 
 static int addTexture(const char* filename, Array<GLuint>& textures,
-        Array<TexId>& texIds, bool srgb)
+        TexIds& texIds, bool srgb)
+{
+    const int idFilename = texIds.filenames.intern(filename);
+    bool inserted;
+    const int idx = texIds.indices.insert(idFilename * 2 + srgb, textures.size(), &inserted);
+
+    if(inserted)
+    {
+        textures.pushBack(0); // created by createPendingTextures()
+        texIds.ids.pushBack({idFilename, srgb});
+    }
+
+    return idx;
+}
+
+// the files are decoded on the job system, the gl textures are created on this thread
+static void createPendingTextures(JobSystem& jobSystem, Array<GLuint>& textures, const TexIds& texIds)
+{
+    Array<int> pending;
+
+    for(int i = 0; i < textures.size(); ++i)
+    {
+        if(!textures[i])
+            pending.pushBack(i);
+    }
+
+    Array<TextureImage> images;
+    images.resize(pending.size());
+
+    auto decode = [&](int begin, int end)
+    {
+        for(int i = begin; i < end; ++i)
+            images[i] = decodeTexture(texIds.filenames.getString(texIds.ids[pending[i]].filename));
+    };
+
+    const double start = glfwGetTime();
+    jobSystem.parallelFor(pending.size(), 1, decode);
+    const double decodeMs = (glfwGetTime() - start) * 1000.0;
+
+    for(int i = 0; i < pending.size(); ++i)
+    {
+        const TexId& texId = texIds.ids[pending[i]];
+
+        if(!images[i].data)
+            log("stbi_load() failed: %s", texIds.filenames.getString(texId.filename));
+
+        textures[pending[i]] = createTexture(images[i], texId.srgb);
+    }
+
+    log("decoded %d textures on %d threads in %.1f ms", pending.size(), jobSystem.getThreadCount(), decodeMs);
+}
+
+static const char* const sponzaFilename = "data/sponza/sponza.obj";
+
+// for offline processing; all triangles of a file in the order of loadModel() meshes
+static void loadTriangles(const char* filename, Array<vec3>& vertices, Array<int>& triangleMeshes)
+{
+    Assimp::Importer importer;
+    const aiScene* const scene = importer.ReadFile(filename, aiProcess_Triangulate);
+
+    if(!scene)
+    {
+        log("Assimp::Importer::ReadFile() failed, %s", filename);
+        return;
+    }
+
+    for(unsigned idxMesh = 0; idxMesh < scene->mNumMeshes; ++idxMesh)
+    {
+        const aiMesh& aimesh = *scene->mMeshes[idxMesh];
+
+        for(unsigned idxFace = 0; idxFace < aimesh.mNumFaces; ++idxFace)
+        {
+            const aiFace& face = aimesh.mFaces[idxFace];
+
+            if(face.mNumIndices != 3)
+                continue;
+
+            for(int i = 0; i < 3; ++i)
+            {
+                const aiVector3D v = aimesh.mVertices[face.mIndices[i]];
+                vertices.pushBack({v.x, v.y, v.z});
+            }
+
+            triangleMeshes.pushBack(idxMesh);
+        }
+    }
+}
+
+// the static scene is sponza only; returns false if pvs was left unchanged
+static bool buildScenePvs(Pvs& pvs, const std::vector<Model>& models, const Array<Mesh>& meshes, float cellSize,
+                          float walkableHeight, int raysPerCell)
 {
-    int idx = 0;
-    for(TexId id: texIds)
+    const double start = glfwGetTime();
+
+    if(models.size() != 1)
+    {
+        log("buildScenePvs(): expected only %s in the static scene", sponzaFilename);
+        return false;
+    }
+
+    Array<vec3> vertices;
+    Array<int> triangleMeshes;
+    loadTriangles(sponzaFilename, vertices, triangleMeshes);
+
+    if(triangleMeshes.empty())
     {
-        if( (strcmp(id.filename, filename) == 0) && (id.srgb == srgb) )
-            return idx;
-        ++idx;
+        log("buildScenePvs(): no triangles in %s", sponzaFilename);
+        return false;
+    }
+
+    const Model& model = models.front();
+
+    for(vec3& v: vertices)
+        v = vec3(model.transform * vec4(v, 1.f));
+
+    Array<vec3> instanceMin;
+    Array<vec3> instanceMax;
+    vec3 sceneMin(INFINITY);
+    vec3 sceneMax(-INFINITY);
+
+    for(int i = 0; i < model.meshCount; ++i)
+    {
+        vec3 bmin(INFINITY);
+        vec3 bmax(-INFINITY);
+
+        for(vec3 p: meshes[model.idxMesh + i].bbox.vertices)
+        {
+            p = vec3(model.transform * vec4(p, 1.f));
+
+            for(int k = 0; k < 3; ++k)
+            {
+                bmin[k] = min(bmin[k], p[k]);
+                bmax[k] = max(bmax[k], p[k]);
+                sceneMin[k] = min(sceneMin[k], p[k]);
+                sceneMax[k] = max(sceneMax[k], p[k]);
+            }
+        }
+
+        instanceMin.pushBack(bmin);
+        instanceMax.pushBack(bmax);
     }
 
-    textures.pushBack(createTexture(filename, srgb));
+    PvsBuildInput input;
+    input.vertices = vertices.data();
+    input.triangleInstances = triangleMeshes.data();
+    input.triangleCount = triangleMeshes.size();
+    input.instanceMin = instanceMin.data();
+    input.instanceMax = instanceMax.data();
+    input.instanceCount = model.meshCount;
+    input.gridMin = sceneMin;
+    input.gridMax = vec3(sceneMax.x, min(sceneMax.y, sceneMin.y + walkableHeight), sceneMax.z);
+    input.cellSize = cellSize;
+    input.raysPerCell = raysPerCell;
+    input.threadCount = max(1, int(std::thread::hardware_concurrency()));
+
+    buildPvs(pvs, input);
+
+    log("pvs: %d x %d x %d cells, %d bytes, %d threads, %.2f s", pvs.gridSize.x, pvs.gridSize.y,
+        pvs.gridSize.z, pvs.data.size(), input.threadCount, glfwGetTime() - start);
+    return true;
+}
+
+// returns the number of line vertices
+static int uploadPvsGrid(const Pvs& pvs, GLuint bo)
+{
+    Array<vec3> vertices;
+    const ivec3 size = pvs.gridSize;
+    const vec3 gmin = pvs.gridMin;
+    const vec3 gmax = gmin + vec3(size) * pvs.cellSize;
+
+    for(int y = 0; y <= size.y; ++y)
+    {
+        for(int z = 0; z <= size.z; ++z)
+        {
+            vertices.pushBack(vec3(gmin.x, gmin.y + y * pvs.cellSize, gmin.z + z * pvs.cellSize));
+            vertices.pushBack(vec3(gmax.x, gmin.y + y * pvs.cellSize, gmin.z + z * pvs.cellSize));
+        }
+
+        for(int x = 0; x <= size.x; ++x)
+        {
+            vertices.pushBack(vec3(gmin.x + x * pvs.cellSize, gmin.y + y * pvs.cellSize, gmin.z));
+            vertices.pushBack(vec3(gmin.x + x * pvs.cellSize, gmin.y + y * pvs.cellSize, gmax.z));
+        }
+    }
 
-    int size = strlen(filename) + 1;
-    char* buf = (char*)malloc(size);
-    memcpy(buf, filename, size);
-    texIds.pushBack({buf, srgb});
+    for(int x = 0; x <= size.x; ++x)
+    {
+        for(int z = 0; z <= size.z; ++z)
+        {
+            vertices.pushBack(vec3(gmin.x + x * pvs.cellSize, gmin.y, gmin.z + z * pvs.cellSize));
+            vertices.pushBack(vec3(gmin.x + x * pvs.cellSize, gmax.y, gmin.z + z * pvs.cellSize));
+        }
+    }
 
-    return textures.size() - 1;
+    glBindBuffer(GL_ARRAY_BUFFER, bo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vec3) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
+    return vertices.size();
 }
 
 void renderExecuteFrame(const Frame& frame)
@@ -322,16 +408,18 @@ void renderExecuteFrame(const Frame& frame)
     static std::vector<Model> models;
     static std::vector<Model> testModels;
     static Array<Mesh> meshes;
+    static Array<SkinVertex> bindVertices; // of the skinned meshes, for the cpu skinning backend
     static std::vector<Skeleton> skeletons;
     static Array<Material> materials;
     static Array<GLuint> textures;
-    static Array<TexId> texIds;
+    static TexIds texIds;
     static Camera3d camera;
     static Camera3d cameraDebug;
     static Shader shaderPlainColor;
     static Shader shaderDepth;
     static ivec2 prevFramebufferSize = ivec2(-1);
     static int outputView = VIEW_FINAL;
+    static JobSystem jobSystem;
 
     struct
     {
@@ -346,8 +434,31 @@ void renderExecuteFrame(const Frame& frame)
         bool ssao = true;
         bool debugUvs = false;
         bool frustumCulling = true;
+        bool coherentCulling = true;
+        bool pvs = true;
+        // drop meshes that cover less than minPixels
+        bool contributionCulling = false;
+        float minPixels = 2.f;
+        float minPixelsShadow = 2.f; // shadow map texels
+        int occlusionCulling = OCCLUSION_OFF;
+        int occlusionQueryMinIndices = 5000; // skinned meshes are always queried
         int debugCamera = DEBUG_CAMERA_OFF;
         bool testScene;
+        int threads = max(1, int(std::thread::hardware_concurrency())); // including the render thread
+        bool poseCache = true;
+        float poseTimeStep = 1.f / 60.f; // in the clip time
+        int phaseBuckets = 0; // 0 - every model keeps its own phase
+        // skip hidden models, update distant ones at a reduced rate
+        bool animationLod = true;
+        float lodHalfRateDistance = 1500.f;
+        float lodQuarterRateDistance = 3000.f;
+        bool lodReducedBones = true; // for the models updated at a reduced rate
+        bool animatedBounds = true; // sampled per clip, otherwise the bind pose bounds
+        bool boneCapsules = false; // tighten the bounds with the evaluated poses
+        int skinning = SKINNING_MAT3X4;
+        int skinningBackend = SKINNING_BACKEND_TRANSFORM_FEEDBACK;
+        bool crowd = false;
+        int crowdCount = 10000;
     } static config;
 
     struct
@@ -409,55 +520,308 @@ void renderExecuteFrame(const Frame& frame)
         GLuint texture;
     } static ssaoBlur;
 
-    static bool init = true;
-    if(init)
+    // gpu occlusion culling; two phases - first draw what was visible in the previous frame,
+    // build the hi-z pyramid from that depth and test all mesh instances against it;
+    // then draw the ones that became visible (second chance)
+    struct Hiz
     {
-        init = false;
+        enum {GRID_WIDTH = 256};
+        bool available;
+        Shader shaderBuild;
+        Shader shaderTest;
+        GLuint texture;
+        GLuint framebuffer;
+        int levelCount;
+        GLuint vao;
+        GLuint bo;
+        Array<HizInstance> instances;
+        // per instance results, ping-pong between frames
+        GLuint visibility[2];
+        GLuint visibilityFramebuffer[2];
+        Array<GLuint> queriesVisible[2];
+        Array<GLuint> queriesNew;
+        ivec2 gridSize = ivec2(0);
+        int current = 0;
+        bool historyValid = false;
+    } static hiz;
+
+    // occlusion queries against the bounding boxes of expensive meshes; the results
+    // of the previous frame drive conditional rendering in the gbuffer and shadow passes
+    struct
+    {
+        QueryPool gbuffer;
+        QueryPool shadow;
+        int current = 0;
+        bool enabled = false; // in the previous frame
+    } static occlusion;
 
-        glDepthFunc(GL_LESS);
-        glCullFace(GL_BACK);
-        glFrontFace(GL_CCW);
-        glDisable(GL_BLEND);
+    // used by occlusion queries and debug views
+    struct
+    {
+        GLuint vao;
+        GLuint bo;
+    } static cube;
 
-        shaderPlainColor = createShader("glsl/plain-color.vs", "glsl/plain-color.fs");
+    // planes of the culling frustum seen from the debug camera, 4 triangles
+    struct
+    {
+        GLuint vao;
+        GLuint bo;
+    } static debugFrustum;
 
-        shaderDepth = createShader("glsl/quad.vs", "glsl/depth.fs");
-        shaderDepth.bind();
-        shaderDepth.uniform1i("sampler", UNIT_DEFAULT);
+    // potentially visible sets for the static scene (models)
+    struct
+    {
+        const char* filename = "data/sponza/sponza.pvs";
+        Pvs pvs;
+        float cellSize = 200.f;
+        float walkableHeight = 800.f; // above the lowest point of the scene
+        int raysPerCell = 4096;
+        bool debugGrid = false;
+        GLuint vao;
+        GLuint bo;
+        int lineVertexCount = 0;
+    } static pvs;
 
-        addTexture("data/uv.png", textures, texIds, false);
-        materials.pushBack({});
-        skeletons.push_back({});
+    // frustum culling results per mesh instance; planes that culled or fully contained
+    // a box are remembered between frames
+    struct
+    {
+        // the frustum barely moved if all planes are within these bounds of the reference
+        const float maxPlaneShift = 0.5f;
+        const float minPlaneCos = 0.9999f;
+
+        Frustum reference;
+        Frustum last;
+        bool lastValid = false;
+        const std::vector<Model>* lastModels = nullptr;
+        Array<CullCache> caches;
+        Array<char> visible;
+        int pvsCell = -1;
+        int lastPvsCell = -1;
+        Array<unsigned char> pvsBits;
+
+        // stats
+        bool reused;
+        bool skipInside;
+        int numPvsCulled = 0;
+    } static culling;
 
-        loadModel("data/sphere.obj", models, meshes, skeletons, materials, textures, texIds);
+    struct
+    {
+        int instanceCount = 1000;
+        int frameCount = 100;
+        int threadCounts[4] = {1, 2, 4, 8};
+        double msPerFrame[4][2] = {}; // recursive baseline, flat; 0 - not run yet
+    } static animationBenchmark;
 
-        if(models.empty())
-        {
-            printf("missing data/sphere.obj, run application from top source directory\n");
-            assert(false);
-        }
+    struct
+    {
+        int jobCount = 1000000;
+        int threadCounts[4] = {1, 2, 4, 8};
+        double jobsPerSecond[2][4] = {}; // [split, queued], 0 - not run yet
+        double idlePercent[2][4];
+    } static jobBenchmark;
 
-        // hack
-        sphereModel = models.front();
-        models.pop_back();
+    struct
+    {
+        // [reused vertex data, vertex data per mesh, small arrays][std::vector, Array, pool, arena or inline]
+        double ns[3][4] = {}; // 0 - not run yet
+        long long heapCalls[3][4];
+    } static containerBenchmark;
 
-        loadModel("data/camera.obj", models, meshes, skeletons, materials, textures, texIds);
-        cameraModel = models.front();
-        models.pop_back();
+    struct
+    {
+        double ns[2][3] = {}; // 0 - not run yet
+    } static mapBenchmark;
 
-        loadModel("data/plane.obj", testModels, meshes, skeletons, materials, textures, texIds);
-        testModels.back().transform = translate({0.f, -300.f, 0.f}) * scale(vec3(5000.f));
-        loadModel("data/cyborg/cyborg.obj", testModels, meshes, skeletons, materials, textures, texIds);
-        testModels.back().transform = scale(vec3(50.f));
-        loadModel("data/goblin.dae", testModels, meshes, skeletons, materials, textures, texIds);
-        {
-            // this must not be a reference (pointer invalidation)
-            const Model prototype1 = testModels.back();
-            const Model prototype2 = *(&testModels.back() - 1);
+    struct
+    {
+        double ns[3][3] = {}; // 0 - not run yet
+        float maxError[3] = {};
+        bool passed = true;
+    } static mathBenchmark;
+
+    // stress test, instanced goblins animated from baked bone palettes; the only per instance
+    // cpu work is advancing its clip time
+    struct
+    {
+        enum {MAX_COUNT = 10000};
+        const float sampleRate = 30.f; // frames per unit of the clip time
+        const float radius = 3000.f;
+
+        Model prototype; // its skinned meshes get the per instance attributes
+        BakedAnimations baked;
+        GLuint texture;
+        GLuint transformBo; // static
+        GLuint timeBo; // updated every frame
+        Array<float> times;
+        Shader shader;
+        Shader shaderShadow;
+        bool available = false;
+    } static crowd;
+
+    // poses shared between models within a frame
+    struct
+    {
+        std::vector<PoseOwner> owners;
+        std::vector<mat4> poses; // skeleton bones of the owners, packed into palettes
+        int frameIndex = 0;
+        int poseSize; // in matrices
+        int skinning = SKINNING_MAT3X4; // of the previous frame
+        GLuint bo;
+        GLuint texture;
+    } static poseCache;
+
+    // skinning pre-pass; transform feedback or the cpu writes the vertices in the layout of the
+    // static meshes (SkinnedVertex), every palette is skinned once and the result is used by
+    // the shadow and gbuffer passes
+    struct
+    {
+        Shader shader;
+        GLuint bo;
+        double cpuMs = 0.0;
+    } static skinning;
+
+    struct InstanceState
+    {
+        BoundingBox bounds; // model space
+        int paletteOffset; // of the mesh palette, in texels
+        int baseVertex; // of the pre-skinned vertices
+    };
+
+    // everything the render stage needs from the simulation of a frame (animation and visibility);
+    // written only by the simulation thread, then read only by the render thread
+    struct FramePacket
+    {
+        // input
+        decltype(config) settings; // config of the frame, the gui changes the live one
+        std::vector<Model>* models;
+        float dt;
+        Frustum frustum; // of the culling camera
+        vec3 cameraPos; // of the culling camera
+        vec3 viewPos; // of the active camera
+        mat4 lightSpaceMatrix;
+
+        // output
+        Array<int> firstInstances; // per model
+        Array<char> visible; // per mesh instance, after pvs and frustum culling
+        Array<InstanceState> instances;
+        // mesh palettes of all evaluated and reused poses, uploaded once to the texture buffer;
+        // the previous packet is read by the models updated at a reduced rate
+        std::vector<vec4> palettes;
+        int paletteSize; // in texels
+        int skinning; // palette format
+        std::vector<int> skinnedModels; // one per palette, skinned in the pre-pass
+        int skinnedSize; // in vertices
+
+        // stats
+        bool cullingReused;
+        bool skipInside;
+        int pvsCell;
+        int numPvsCulled;
+        int numAnimated;
+        int numPoses;
+        int numHidden;
+        int numReused;
+        int numReduced;
+        double updateMs;
+        double simulationMs;
+        int arenaUsed; // bytes of the frame arena of the simulation thread
+    };
+
+    // frame N + 1 is simulated on its own thread while this one submits frame N; packets are
+    // simulated in order, the render thread takes the one that is at most maxLatency frames
+    // behind the newest input
+    struct
+    {
+        enum {PACKET_COUNT = 3};
+        FramePacket packets[PACKET_COUNT];
+        std::thread* thread = nullptr;
+        std::mutex mutex;
+        std::condition_variable cv;
+        int submitted = 0; // frames
+        int completed = 0;
+        bool quit = false;
+        int maxLatency = 1; // 0 - the render thread waits for the simulation of the current frame
+        float cullingMargin = 10.f; // degrees added to fovy, the view is sampled again before rendering
+        double waitMs = 0.0; // of the render thread for its packet
+    } static pipeline;
+
+    // heap calls of all threads between the starts of two frames; there should be none in
+    // a steady state, per frame temporaries go to the frame arenas
+    struct
+    {
+        enum {SAMPLE_COUNT = 200};
+        HeapStats last = {};
+        float allocations[SAMPLE_COUNT] = {};
+        int frees = 0;
+    } static heapCalls;
+
+    // the simulation thread must be idle before its input state is changed
+    auto finishSimulation = []
+    {
+        std::unique_lock<std::mutex> lock(pipeline.mutex);
+        pipeline.cv.wait(lock, [] { return pipeline.completed == pipeline.submitted; });
+    };
+
+    static bool init = true;
+    if(init)
+    {
+        init = false;
+
+        glDepthFunc(GL_LESS);
+        glCullFace(GL_BACK);
+        glFrontFace(GL_CCW);
+        glDisable(GL_BLEND);
+
+        shaderPlainColor = createShader("glsl/plain-color.vs", "glsl/plain-color.fs");
+
+        shaderDepth = createShader("glsl/quad.vs", "glsl/depth.fs");
+        shaderDepth.bind();
+        shaderDepth.uniform1i("sampler", UNIT_DEFAULT);
+
+        addTexture("data/uv.png", textures, texIds, false);
+        materials.pushBack({});
+        skeletons.push_back({});
+
+        loadModel("data/sphere.obj", models, meshes, bindVertices, skeletons, materials, textures, texIds);
+
+        if(models.empty())
+        {
+            printf("missing data/sphere.obj, run application from top source directory\n");
+            assert(false);
+        }
+
+        // hack
+        sphereModel = models.front();
+        models.pop_back();
+
+        loadModel("data/camera.obj", models, meshes, bindVertices, skeletons, materials, textures, texIds);
+        cameraModel = models.front();
+        models.pop_back();
+
+        loadModel("data/plane.obj", testModels, meshes, bindVertices, skeletons, materials, textures, texIds);
+        testModels.back().transform = translate({0.f, -300.f, 0.f}) * scale(vec3(5000.f));
+        loadModel("data/cyborg/cyborg.obj", testModels, meshes, bindVertices, skeletons, materials, textures, texIds);
+        testModels.back().transform = scale(vec3(50.f));
+        loadModel("data/goblin.dae", testModels, meshes, bindVertices, skeletons, materials, textures, texIds);
+
+        if(!testModels.empty() && testModels.back().idxSkeleton)
+        {
+            crowd.prototype = testModels.back();
+            crowd.available = true;
+        }
+
+        {
+            // this must not be a reference (pointer invalidation)
+            const Model prototype1 = testModels.back();
+            const Model prototype2 = *(&testModels.back() - 1);
 
             for(int i = 0; i < 97; ++i)
             {
                 Model model = randomFloat() > 0.5f ? prototype1 : prototype2;
+                model.animationPhase = randomFloat();
 
                 model.transform =
                         translate(vec3(randomFloat() * 2.f - 1.f, randomFloat() * 0.3f, randomFloat() * 2.f - 1.f) * 2000.f) *
@@ -469,7 +833,11 @@ void renderExecuteFrame(const Frame& frame)
             }
         }
 
-        loadModel("data/sponza/sponza.obj", models, meshes, skeletons, materials, textures, texIds);
+        loadModel(sponzaFilename, models, meshes, bindVertices, skeletons, materials, textures, texIds);
+
+        // the simulation thread gets its own deque, it does not share the jobs of this one
+        jobSystem.start(config.threads, 1);
+        createPendingTextures(jobSystem, textures, texIds);
 
         log("number of meshes:    %d", meshes.size());
         log("number of textures:  %d", textures.size());
@@ -504,6 +872,8 @@ void renderExecuteFrame(const Frame& frame)
         {
             shadowMap.shader = createShader("glsl/shadow.vs", "glsl/shadow.fs");
             shadowMap.shaderAnim = createShader("glsl/shadow-anim.vs", "glsl/shadow.fs");
+            shadowMap.shaderAnim.bind();
+            shadowMap.shaderAnim.uniform1i("samplerBones", UNIT_BONES);
 
             glGenTextures(1, &shadowMap.depthBuffer);
             glBindTexture(GL_TEXTURE_2D, shadowMap.depthBuffer);
@@ -546,6 +916,9 @@ void renderExecuteFrame(const Frame& frame)
                 }
             }
 
+            gbuffer.shaderAnim.bind();
+            gbuffer.shaderAnim.uniform1i("samplerBones", UNIT_BONES);
+
             glGenTextures(1, &gbuffer.depthBuffer);
             glBindTexture(GL_TEXTURE_2D, gbuffer.depthBuffer);
             // to enable preview
@@ -715,14 +1088,298 @@ void renderExecuteFrame(const Frame& frame)
             glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
                     GL_TEXTURE_2D, ssaoBlur.texture, 0);
         }
+
+        // hi-z
+        {
+            hiz.shaderBuild = createShader("glsl/quad.vs", "glsl/hiz.fs");
+            hiz.shaderBuild.bind();
+            hiz.shaderBuild.uniform1i("sampler", UNIT_DEFAULT);
+
+            hiz.shaderTest = createShader("glsl/hiz-test.vs", "glsl/hiz-test.fs");
+            hiz.shaderTest.bind();
+            hiz.shaderTest.uniform1i("samplerHiz", UNIT_HIZ);
+            hiz.shaderTest.uniform1i("samplerVisibility", UNIT_VISIBILITY);
+
+            hiz.available = hiz.shaderBuild.programId && hiz.shaderTest.programId;
+
+            if(!hiz.available)
+                log("hi-z occlusion culling is not available, using cpu culling only");
+
+            glGenTextures(1, &hiz.texture);
+            glBindTexture(GL_TEXTURE_2D, hiz.texture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+            glGenFramebuffers(1, &hiz.framebuffer);
+            glBindFramebuffer(GL_FRAMEBUFFER, hiz.framebuffer);
+            glDrawBuffer(GL_COLOR_ATTACHMENT0);
+            glReadBuffer(GL_NONE);
+
+            glGenTextures(2, hiz.visibility);
+            glGenFramebuffers(2, hiz.visibilityFramebuffer);
+
+            for(int i = 0; i < 2; ++i)
+            {
+                glBindTexture(GL_TEXTURE_2D, hiz.visibility[i]);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+                glBindFramebuffer(GL_FRAMEBUFFER, hiz.visibilityFramebuffer[i]);
+                glDrawBuffer(GL_COLOR_ATTACHMENT0);
+                glReadBuffer(GL_NONE);
+
+                glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                        GL_TEXTURE_2D, hiz.visibility[i], 0);
+            }
+
+            glGenVertexArrays(1, &hiz.vao);
+            glGenBuffers(1, &hiz.bo);
+
+            glBindBuffer(GL_ARRAY_BUFFER, hiz.bo);
+            glBindVertexArray(hiz.vao);
+
+            const GLsizei stride = sizeof(HizInstance);
+
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride,
+                    reinterpret_cast<const void*>(offsetof(HizInstance, bboxMin)));
+            glEnableVertexAttribArray(0);
+
+            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride,
+                    reinterpret_cast<const void*>(offsetof(HizInstance, bboxMax)));
+            glEnableVertexAttribArray(1);
+
+            for(int i = 0; i < 4; ++i)
+            {
+                glVertexAttribPointer(2 + i, 4, GL_FLOAT, GL_FALSE, stride,
+                        reinterpret_cast<const void*>(offsetof(HizInstance, model) + i * sizeof(vec4)));
+                glEnableVertexAttribArray(2 + i);
+            }
+        }
+
+        // unit cube
+        {
+            vec3 vertices[36];
+            const int faces[6][4] = {
+                {0, 2, 3, 1}, {4, 5, 7, 6}, {0, 1, 5, 4},
+                {2, 6, 7, 3}, {0, 4, 6, 2}, {1, 3, 7, 5}
+            };
+
+            int count = 0;
+            for(const auto& face: faces)
+            {
+                const int order[] = {0, 1, 2, 2, 3, 0};
+
+                for(int i: order)
+                {
+                    const int v = face[i];
+                    vertices[count++] = vec3(v & 1, (v >> 1) & 1, (v >> 2) & 1);
+                }
+            }
+
+            glGenVertexArrays(1, &cube.vao);
+            glGenBuffers(1, &cube.bo);
+
+            glBindBuffer(GL_ARRAY_BUFFER, cube.bo);
+            glBufferData(GL_ARRAY_BUFFER, sizeof vertices, vertices, GL_STATIC_DRAW);
+
+            glBindVertexArray(cube.vao);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+            glEnableVertexAttribArray(0);
+        }
+
+        // debug frustum
+        {
+            glGenVertexArrays(1, &debugFrustum.vao);
+            glGenBuffers(1, &debugFrustum.bo);
+
+            glBindBuffer(GL_ARRAY_BUFFER, debugFrustum.bo);
+            glBufferData(GL_ARRAY_BUFFER, sizeof(vec3) * 12, nullptr, GL_DYNAMIC_DRAW);
+
+            glBindVertexArray(debugFrustum.vao);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+            glEnableVertexAttribArray(0);
+        }
+
+        // pvs
+        {
+            glGenVertexArrays(1, &pvs.vao);
+            glGenBuffers(1, &pvs.bo);
+
+            glBindBuffer(GL_ARRAY_BUFFER, pvs.bo);
+            glBindVertexArray(pvs.vao);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+            glEnableVertexAttribArray(0);
+
+            if(loadPvs(pvs.pvs, pvs.filename))
+            {
+                log("loaded %s", pvs.filename);
+                pvs.lineVertexCount = uploadPvsGrid(pvs.pvs, pvs.bo);
+            }
+        }
+
+        // bone palettes
+        {
+            glGenBuffers(1, &poseCache.bo);
+            glGenTextures(1, &poseCache.texture);
+            glBindBuffer(GL_TEXTURE_BUFFER, poseCache.bo);
+            glBindTexture(GL_TEXTURE_BUFFER, poseCache.texture);
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, poseCache.bo);
+        }
+
+        // skinning pre-pass
+        {
+            const char* varyings[] = {"tfVertex", "tfTexCoord", "tfNormal", "tfTangent", "tfBitangent"};
+            skinning.shader = createShader("glsl/skin.vs", nullptr, varyings, getSize(varyings));
+            skinning.shader.bind();
+            skinning.shader.uniform1i("samplerBones", UNIT_BONES);
+
+            glGenBuffers(1, &skinning.bo);
+            glBindBuffer(GL_ARRAY_BUFFER, skinning.bo);
+            const GLsizei stride = sizeof(SkinnedVertex);
+            const int attributeSizes[] = {3, 2, 3, 3, 3};
+            const std::vector<Model>* modelLists[] = {&models, &testModels};
+
+            for(const std::vector<Model>* modelList: modelLists)
+            {
+                for(const Model& model: *modelList)
+                {
+                    if(!model.idxSkeleton)
+                        continue;
+
+                    for(int i = 0; i < model.meshCount; ++i)
+                    {
+                        Mesh& mesh = meshes[model.idxMesh + i];
+
+                        if(mesh.skinnedVao)
+                            continue;
+
+                        glGenVertexArrays(1, &mesh.skinnedVao);
+                        glBindVertexArray(mesh.skinnedVao);
+                        int offset = 0;
+
+                        for(int k = 0; k < getSize(attributeSizes); ++k)
+                        {
+                            glVertexAttribPointer(k, attributeSizes[k], GL_FLOAT, GL_FALSE, stride,
+                                                  reinterpret_cast<const void*>(offset));
+                            glEnableVertexAttribArray(k);
+                            offset += attributeSizes[k] * sizeof(float);
+                        }
+
+                        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.bo);
+                    }
+                }
+            }
+        }
+
+        // crowd
+        if(crowd.available)
+        {
+            const Model& prototype = crowd.prototype;
+            const Skeleton& skeleton = skeletons[prototype.idxSkeleton];
+            const double start = glfwGetTime();
+
+            bakeAnimations(skeleton, prototype.boneMap, crowd.sampleRate, crowd.baked);
+
+            log("baked animations: %d clips, %d x %d texels, %.3f s", int(skeleton.animations.size()),
+                crowd.baked.width(), crowd.baked.height(), glfwGetTime() - start);
+
+            // rows are interpolated by the sampler
+            glGenTextures(1, &crowd.texture);
+            glBindTexture(GL_TEXTURE_2D, crowd.texture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, crowd.baked.width(), crowd.baked.height(), 0, GL_RGBA,
+                    GL_FLOAT, crowd.baked.texels.data());
+
+            crowd.shader = createShader("glsl/anim-baked.vs", "glsl/gbuffer.fs");
+            crowd.shader.bind();
+            crowd.shader.uniform1i("samplerDiffuse", UNIT_DIFFUSE);
+            crowd.shader.uniform1i("samplerSpecular", UNIT_SPECULAR);
+            crowd.shader.uniform1i("samplerNormal", UNIT_NORMAL);
+            crowd.shader.uniform1i("samplerBaked", UNIT_BAKED_ANIMATION);
+
+            crowd.shaderShadow = createShader("glsl/shadow-anim-baked.vs", "glsl/shadow.fs");
+            crowd.shaderShadow.bind();
+            crowd.shaderShadow.uniform1i("samplerBaked", UNIT_BAKED_ANIMATION);
+
+            const float duration = skeleton.animations[prototype.currentAnimation].duration;
+            Array<mat4> transforms;
+
+            for(int i = 0; i < crowd.MAX_COUNT; ++i)
+            {
+                // uniform over a disc
+                const float r = sqrtf(randomFloat()) * crowd.radius;
+                const float angle = randomFloat() * 360.f;
+                const vec4 pos = rotateY(angle) * vec4(r, 0.f, 0.f, 1.f);
+
+                transforms.pushBack(translate(vec3(pos)) * rotateY(randomFloat() * 360.f) * prototype.transform);
+                crowd.times.pushBack(randomFloat() * duration);
+            }
+
+            glGenBuffers(1, &crowd.transformBo);
+            glBindBuffer(GL_ARRAY_BUFFER, crowd.transformBo);
+            glBufferData(GL_ARRAY_BUFFER, sizeof(mat4) * transforms.size(), transforms.data(), GL_STATIC_DRAW);
+
+            glGenBuffers(1, &crowd.timeBo);
+            glBindBuffer(GL_ARRAY_BUFFER, crowd.timeBo);
+            glBufferData(GL_ARRAY_BUFFER, sizeof(float) * crowd.times.size(), nullptr, GL_STREAM_DRAW);
+
+            // not used by the other shaders
+            for(int i = 0; i < prototype.meshCount; ++i)
+            {
+                glBindVertexArray(meshes[prototype.idxMesh + i].vao);
+                glBindBuffer(GL_ARRAY_BUFFER, crowd.transformBo);
+
+                for(int k = 0; k < 4; ++k)
+                {
+                    glVertexAttribPointer(7 + k, 4, GL_FLOAT, GL_FALSE, sizeof(mat4),
+                            reinterpret_cast<const void*>(sizeof(vec4) * k));
+                    glEnableVertexAttribArray(7 + k);
+                    glVertexAttribDivisor(7 + k, 1);
+                }
+
+                glBindBuffer(GL_ARRAY_BUFFER, crowd.timeBo);
+                glVertexAttribPointer(11, 1, GL_FLOAT, GL_FALSE, sizeof(float), nullptr);
+                glEnableVertexAttribArray(11);
+                glVertexAttribDivisor(11, 1);
+            }
+        }
     }
 
     if(frame.quit)
     {
+        if(pipeline.thread)
+        {
+            {
+                std::lock_guard<std::mutex> lock(pipeline.mutex);
+                pipeline.quit = true;
+            }
+
+            pipeline.cv.notify_all();
+            pipeline.thread->join();
+            delete pipeline.thread;
+            pipeline.thread = nullptr;
+        }
+
         // do the cleanup...
         return;
     }
 
+    beginFrameArena();
+
+    {
+        const HeapStats stats = getHeapStats();
+        const int count = getSize(heapCalls.allocations);
+        memmove(heapCalls.allocations, heapCalls.allocations + 1, sizeof(float) * (count - 1));
+        heapCalls.allocations[count - 1] = stats.allocations - heapCalls.last.allocations;
+        heapCalls.frees = stats.frees - heapCalls.last.frees;
+        heapCalls.last = stats;
+    }
+
     for(const WinEvent& e: frame.winEvents)
     {
         if(config.debugCamera == DEBUG_CAMERA_WITH_CONTROL)
@@ -779,6 +1436,25 @@ void renderExecuteFrame(const Frame& frame)
             glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, size.x, size.y, 0, GL_RED, GL_UNSIGNED_BYTE,
                     nullptr);
         }
+        // hi-z; the first level has half of the depth buffer resolution
+        {
+            glBindTexture(GL_TEXTURE_2D, hiz.texture);
+            ivec2 levelSize = size;
+            hiz.levelCount = 0;
+
+            do
+            {
+                levelSize = ivec2(max(levelSize.x / 2, 1), max(levelSize.y / 2, 1));
+                glTexImage2D(GL_TEXTURE_2D, hiz.levelCount, GL_R32F, levelSize.x, levelSize.y, 0,
+                        GL_RED, GL_FLOAT, nullptr);
+                ++hiz.levelCount;
+            }
+            while(levelSize.x > 1 || levelSize.y > 1);
+
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, hiz.levelCount - 1);
+            hiz.historyValid = false;
+        }
     }
 
     struct
@@ -811,136 +1487,1121 @@ void renderExecuteFrame(const Frame& frame)
             lookAt(normalize(lpos) * size, vec3(0.f), vec3(0.f, 1.f, 0.f));
     }
 
-    std::vector<Model>& activeModels = config.testScene ? testModels : models;
-
-    for(Model& model: activeModels)
+    // the simulation stage; reads only the packet input and the state owned by the simulation thread
+    static auto simulate = [](int index)
     {
-        if(!model.idxSkeleton)
-            continue;
+        FramePacket& packet = pipeline.packets[index % pipeline.PACKET_COUNT];
+        const FramePacket& prevPacket = pipeline.packets[(index + pipeline.PACKET_COUNT - 1) % pipeline.PACKET_COUNT];
+        const auto& config = packet.settings;
+        std::vector<Model>& activeModels = *packet.models;
+        const Frustum& frustum = packet.frustum;
+        const mat4& lightSpaceMatrix = packet.lightSpaceMatrix;
+        const double start = glfwGetTime();
+        beginFrameArena();
+
+        int instanceCount = 0;
+        packet.firstInstances.resize(activeModels.size());
+
+        for(int i = 0; i < int(activeModels.size()); ++i)
+        {
+            packet.firstInstances[i] = instanceCount;
+            instanceCount += activeModels[i].meshCount;
+        }
 
-        const Skeleton& skeleton = skeletons[model.idxSkeleton];
-        const Animation& animation = skeleton.animations[model.currentAnimation];
-        model.animationTime += frame.dt;
-        model.animationTime = fmod(model.animationTime, animation.duration);
-        updateBones(animation, model.animationTime, skeleton.rootBone, mat4(), model.boneTransformations.data());
-    }
+        // animation clocks run before culling, the bounds of the skinned meshes follow the pose
+        for(Model& model: activeModels)
+        {
+            if(!model.idxSkeleton)
+                continue;
 
-    // render shadow map
-    if(outputView == VIEW_FINAL || outputView == VIEW_SHADOWMAP)
-    {
-        glBindFramebuffer(GL_FRAMEBUFFER, shadowMap.framebuffer);
-        glClear(GL_DEPTH_BUFFER_BIT);
+            const Animation& animation = skeletons[model.idxSkeleton].animations[model.currentAnimation];
+
+            // the clock runs even if the pose is not evaluated, a revealed model catches up immediately
+            model.animationTime = fmod(model.animationTime + packet.dt, animation.duration);
+
+            float phase = model.animationPhase;
+
+            if(config.phaseBuckets)
+                phase = floorf(phase * config.phaseBuckets) / config.phaseBuckets;
+
+            const float time = fmod(model.animationTime + phase * animation.duration, animation.duration);
+
+            // models playing the same clip at the same quantized time share the pose; every pose is
+            // quantized, shared or not, so the playback steps evenly whoever shares it
+            model.poseTime = config.poseCache ? int(time / config.poseTimeStep) * config.poseTimeStep : time;
+
+            for(int i = 0; i < model.meshCount; ++i)
+            {
+                if(config.animatedBounds)
+                {
+                    vec3 bmin, bmax;
+                    getAnimationBounds(animation, i, model.poseTime, bmin, bmax);
+                    model.meshBounds[i] = makeBoundingBox(bmin, bmax);
+                }
+                else
+                    model.meshBounds[i] = meshes[model.idxMesh + i].bbox;
+            }
+        }
+
+        // model space
+        auto getBounds = [&](const Model& model, int idxMesh) -> const BoundingBox&
+        {
+            return model.idxSkeleton ? model.meshBounds[idxMesh] : meshes[model.idxMesh + idxMesh].bbox;
+        };
+
+        // pvs and frustum culling
+        {
+            const int pvsCell = config.pvs && &activeModels == &models && pvs.pvs.instanceCount == instanceCount ?
+                                getPvsCell(pvs.pvs, packet.cameraPos) : -1;
+
+            if(pvsCell != -1 && pvsCell != culling.pvsCell)
+                decompressPvsCell(pvs.pvs, pvsCell, culling.pvsBits);
+
+            culling.pvsCell = pvsCell;
+
+            auto isInPvs = [&](int idxInstance)
+            {
+                return pvsCell == -1 || (culling.pvsBits[idxInstance / 8] & (1 << (idxInstance % 8)));
+            };
+
+            auto frustumCull = [&](const Model& model, int idxMesh, int idxInstance)
+            {
+                const BoundingBox& bbox = getBounds(model, idxMesh);
+                bool culled = false;
+
+                if(config.frustumCulling && config.coherentCulling)
+                    culled = cull(frustum, bbox, model.transform, culling.caches[idxInstance], culling.skipInside);
+                else if(config.frustumCulling)
+                    culled = cull(frustum, bbox, model.transform);
+
+                culling.visible[idxInstance] = !culled;
+            };
+
+            // models are never moved after they are loaded, so the scene is static as long
+            // as the same set is active (except for the skinned meshes); if nothing moved reuse the last results
+            culling.reused = config.frustumCulling && culling.lastValid && culling.lastModels == &activeModels &&
+                             culling.visible.size() == instanceCount && culling.lastPvsCell == pvsCell &&
+                             memcmp(&culling.last.planes, &frustum.planes, sizeof(frustum.planes)) == 0;
+
+            if(!culling.reused)
+            {
+                if(culling.caches.size() != instanceCount || culling.lastModels != &activeModels)
+                {
+                    culling.caches.resize(instanceCount);
+
+                    for(CullCache& cache: culling.caches)
+                        cache = {};
+
+                    culling.lastValid = false;
+                }
+
+                culling.visible.resize(instanceCount);
+
+                culling.skipInside = config.coherentCulling && culling.lastValid &&
+                                     isNear(frustum, culling.reference, culling.maxPlaneShift, culling.minPlaneCos);
+
+                // plane containment is recorded relative to the reference
+                if(!culling.skipInside)
+                    culling.reference = frustum;
+
+                std::atomic<int> numPvsCulled(0);
+
+                // every instance writes only its own visibility and cache
+                auto cullModels = [&](int begin, int end)
+                {
+                    int numCulled = 0;
+
+                    for(int idxModel = begin; idxModel < end; ++idxModel)
+                    {
+                        const Model& model = activeModels[idxModel];
+                        const int firstInstance = packet.firstInstances[idxModel];
+
+                        for(int i = 0; i < model.meshCount; ++i)
+                        {
+                            const int idxInstance = firstInstance + i;
+
+                            // the pvs lookup goes before any frustum work
+                            if(!isInPvs(idxInstance))
+                            {
+                                culling.visible[idxInstance] = false;
+                                ++numCulled;
+                                continue;
+                            }
+
+                            frustumCull(model, i, idxInstance);
+                        }
+                    }
+
+                    numPvsCulled += numCulled;
+                };
+
+                jobSystem.parallelFor(activeModels.size(), 64, cullModels);
+                culling.numPvsCulled = numPvsCulled;
+
+                culling.last = frustum;
+                culling.lastValid = config.frustumCulling;
+                culling.lastModels = &activeModels;
+                culling.lastPvsCell = pvsCell;
+            }
+            else
+            {
+                // the bounds of skinned meshes change every frame
+                int idxInstance = 0;
+
+                for(const Model& model: activeModels)
+                {
+                    for(int i = 0; i < model.meshCount; ++i, ++idxInstance)
+                    {
+                        if(model.idxSkeleton && isInPvs(idxInstance))
+                            frustumCull(model, i, idxInstance);
+                    }
+                }
+            }
+        }
+
+        // in the camera view (after pvs and frustum culling) or casting a shadow
+        auto isAnimationVisible = [&](const Model& model, int firstInstance)
+        {
+            for(int i = 0; i < model.meshCount; ++i)
+            {
+                if(culling.visible[firstInstance + i])
+                    return true;
+            }
+
+            if(!config.shadows)
+                return false;
+
+            if(!config.contributionCulling)
+                return true;
+
+            const mat4 mvp = lightSpaceMatrix * model.transform;
+
+            for(int i = 0; i < model.meshCount; ++i)
+            {
+                if(projectedArea(getBounds(model, i), mvp, vec2(ShadowMap::SIZE)) >= config.minPixelsShadow)
+                    return true;
+            }
+
+            return false;
+        };
+
+        const double animationStart = glfwGetTime();
+
+        // models playing the same clip at the same quantized time share the pose of the first one (owner)
+        ++poseCache.frameIndex;
+        std::vector<vec4>& palettes = packet.palettes;
+        const std::vector<vec4>& prevPalettes = prevPacket.palettes;
+        const bool cpuSkinning = config.skinningBackend == SKINNING_BACKEND_CPU;
+        // the cpu backend blends matrices only
+        const int skinningFormat = cpuSkinning ? int(SKINNING_MAT3X4) : config.skinning;
+        const int texelsPerBone = getTexelsPerBone(skinningFormat);
+
+        // the previous palettes can't be reused in a different format
+        if(skinningFormat != poseCache.skinning)
+        {
+            poseCache.skinning = skinningFormat;
+            ++poseCache.frameIndex;
+        }
+
+        packet.skinning = skinningFormat;
+
+        {
+            int maxPaletteSize = 0;
+            int maxPoseSize = 0;
+
+            for(const Model& model: activeModels)
+            {
+                maxPaletteSize += model.boneMap.size() * texelsPerBone;
+                maxPoseSize += model.boneCount;
+            }
+
+            palettes.resize(maxPaletteSize);
+            poseCache.poses.resize(maxPoseSize);
+        }
+
+        // (skeleton, clip, time step) -> owner
+        HashMap<long long, int, ArenaAllocator> slots;
+        poseCache.owners.clear();
+        packet.paletteSize = 0;
+        poseCache.poseSize = 0;
+        packet.skinnedModels.clear();
+        packet.skinnedSize = 0;
+        packet.numAnimated = 0;
+        packet.numHidden = 0;
+        packet.numReused = 0;
+        packet.numReduced = 0;
+
+        for(int i = 0, idxInstance = 0; i < int(activeModels.size()); ++i)
+        {
+            Model& model = activeModels[i];
+            const int firstInstance = idxInstance;
+            const int paletteSize = model.boneMap.size() * texelsPerBone;
+            idxInstance += model.meshCount;
+
+            if(!model.idxSkeleton)
+                continue;
+
+            ++packet.numAnimated;
+            const float time = model.poseTime;
+            model.poseOwner = -1;
+            int rate = 1;
+            bool reduced = false;
+
+            if(config.animationLod)
+            {
+                if(!isAnimationVisible(model, firstInstance))
+                {
+                    ++packet.numHidden;
+                    model.paletteFrame = -1;
+                    continue;
+                }
+
+                const float distance = length(vec3(model.transform.w) - packet.viewPos);
+                rate = distance > config.lodQuarterRateDistance ? 4 : distance > config.lodHalfRateDistance ? 2 : 1;
+                reduced = config.lodReducedBones && rate > 1;
+
+                // models are spread over the frames
+                if(rate > 1 && model.paletteFrame == poseCache.frameIndex - 1 && (poseCache.frameIndex + i) % rate)
+                {
+                    memcpy(&palettes[packet.paletteSize], &prevPalettes[model.paletteOffset],
+                           sizeof(vec4) * paletteSize);
+
+                    model.paletteOffset = packet.paletteSize;
+                    model.paletteFrame = poseCache.frameIndex;
+                    model.skinnedOffset = packet.skinnedSize;
+                    packet.paletteSize += paletteSize;
+                    packet.skinnedModels.push_back(i);
+                    packet.skinnedSize += model.skinnedVertexCount;
+                    ++packet.numReused;
+                    continue;
+                }
+            }
+
+            model.paletteFrame = poseCache.frameIndex;
+
+            if(!config.poseCache)
+            {
+                model.paletteOffset = packet.paletteSize;
+                model.skinnedOffset = packet.skinnedSize;
+                model.poseOwner = poseCache.owners.size();
+                poseCache.owners.push_back({i, time, poseCache.poseSize, model.paletteOffset, reduced});
+                packet.paletteSize += paletteSize;
+                poseCache.poseSize += model.boneCount;
+                packet.skinnedModels.push_back(i);
+                packet.skinnedSize += model.skinnedVertexCount;
+                packet.numReduced += reduced;
+                continue;
+            }
+
+            const int step = time / config.poseTimeStep + 0.5f; // time is already quantized
+            const long long key = (long long)model.idxSkeleton << 48 | (long long)reduced << 47 |
+                                  (long long)model.currentAnimation << 32 | step;
+            bool inserted;
+            const int idxOwner = slots.insert(key, poseCache.owners.size(), &inserted);
+
+            if(inserted)
+            {
+                poseCache.owners.push_back({i, time, poseCache.poseSize, packet.paletteSize, reduced});
+                model.skinnedOffset = packet.skinnedSize;
+                packet.paletteSize += paletteSize;
+                poseCache.poseSize += model.boneCount;
+                packet.skinnedModels.push_back(i);
+                packet.skinnedSize += model.skinnedVertexCount;
+                packet.numReduced += reduced;
+            }
+
+            const PoseOwner& owner = poseCache.owners[idxOwner];
+            model.poseOwner = idxOwner;
+            model.paletteOffset = owner.paletteOffset;
+            model.skinnedOffset = activeModels[owner.idxModel].skinnedOffset;
+        }
+
+        auto updateAnimations = [&](int begin, int end)
+        {
+            for(int i = begin; i < end; ++i)
+            {
+                const PoseOwner& owner = poseCache.owners[i];
+                Model& model = activeModels[owner.idxModel];
+                const Skeleton& skeleton = skeletons[model.idxSkeleton];
+
+                mat4* bones = &poseCache.poses[owner.poseOffset];
+
+                updateBones(skeleton, skeleton.animations[model.currentAnimation], owner.time, model.keyCursors.data(),
+                            model.nodeTransforms.data(), bones, owner.reduced);
+
+                packPalette(bones, model.boneMap.data(), model.boneMap.size(), skinningFormat,
+                            &palettes[owner.paletteOffset]);
+            }
+        };
+
+        // every owner writes only to its own pose storage; done before the shadow pass
+        jobSystem.parallelFor(poseCache.owners.size(), 4, updateAnimations);
+
+        // the capsules of the evaluated poses are intersected with the sampled bounds, both contain
+        // the pose, instances can only get culled
+        if(config.animatedBounds && config.boneCapsules)
+        {
+            for(int idxModel = 0, idxInstance = 0; idxModel < int(activeModels.size()); ++idxModel)
+            {
+                Model& model = activeModels[idxModel];
+                const int firstInstance = idxInstance;
+                idxInstance += model.meshCount;
+
+                if(model.poseOwner == -1)
+                    continue;
+
+                const mat4* bones = &poseCache.poses[poseCache.owners[model.poseOwner].poseOffset];
+
+                for(int i = 0; i < model.meshCount; ++i)
+                {
+                    const Mesh& mesh = meshes[model.idxMesh + i];
+                    BoundingBox& bounds = model.meshBounds[i];
+                    vec3 bmin, bmax;
+
+                    getCapsuleBounds(model.boneCapsules.data() + mesh.paletteStart, bones,
+                                     model.boneMap.data() + mesh.paletteStart, mesh.boneCount, bmin, bmax);
+
+                    for(int k = 0; k < 3; ++k)
+                    {
+                        bmin[k] = max(bmin[k], bounds.vertices[0][k]);
+                        bmax[k] = min(bmax[k], bounds.vertices[7][k]);
+                    }
+
+                    if(bmin.x > bmax.x || bmin.y > bmax.y || bmin.z > bmax.z)
+                        continue;
+
+                    bounds = makeBoundingBox(bmin, bmax);
+
+                    if(config.frustumCulling && culling.visible[firstInstance + i] &&
+                       cull(frustum, bounds, model.transform))
+                    {
+                        culling.visible[firstInstance + i] = false;
+                    }
+                }
+            }
+        }
+
+        packet.updateMs = (glfwGetTime() - animationStart) * 1000.0;
+
+        packet.instances.resize(instanceCount);
+
+        for(int idxModel = 0; idxModel < int(activeModels.size()); ++idxModel)
+        {
+            const Model& model = activeModels[idxModel];
+
+            for(int i = 0; i < model.meshCount; ++i)
+            {
+                const Mesh& mesh = meshes[model.idxMesh + i];
+                InstanceState& instance = packet.instances[packet.firstInstances[idxModel] + i];
+                instance.bounds = getBounds(model, i);
+                instance.paletteOffset = model.paletteOffset + mesh.paletteStart * texelsPerBone;
+                instance.baseVertex = model.skinnedOffset + mesh.skinnedStart;
+            }
+        }
+
+        packet.visible.resize(instanceCount);
+        memcpy(packet.visible.data(), culling.visible.data(), instanceCount);
+        packet.cullingReused = culling.reused;
+        packet.skipInside = culling.skipInside;
+        packet.pvsCell = culling.pvsCell;
+        packet.numPvsCulled = culling.numPvsCulled;
+        packet.numPoses = poseCache.owners.size();
+        packet.simulationMs = (glfwGetTime() - start) * 1000.0;
+        packet.arenaUsed = getFrameArena().getUsed();
+    };
+
+    if(config.threads != jobSystem.getThreadCount())
+    {
+        finishSimulation();
+        jobSystem.start(config.threads, 1);
+    }
+
+    if(!pipeline.thread)
+    {
+        pipeline.thread = new std::thread([]
+        {
+            jobSystem.attachThread(0);
+
+            for(;;)
+            {
+                int index;
+                {
+                    std::unique_lock<std::mutex> lock(pipeline.mutex);
+                    pipeline.cv.wait(lock, [] { return pipeline.quit || pipeline.completed < pipeline.submitted; });
+
+                    if(pipeline.quit)
+                        return;
+
+                    index = pipeline.completed;
+                }
+
+                simulate(index);
+
+                {
+                    std::lock_guard<std::mutex> lock(pipeline.mutex);
+                    ++pipeline.completed;
+                }
+
+                pipeline.cv.notify_all();
+            }
+        });
+    }
+
+    int renderIndex;
+
+    // the input of the next packet is taken as late as possible, right after the events were processed
+    {
+        const int latency = min(pipeline.maxLatency, pipeline.PACKET_COUNT - 1);
+        FramePacket& packet = pipeline.packets[pipeline.submitted % pipeline.PACKET_COUNT];
+        packet.settings = config;
+        packet.models = config.testScene ? &testModels : &models;
+        packet.dt = frame.dt;
+        packet.cameraPos = camera.pos;
+        packet.viewPos = activeCamera.pos;
+        packet.lightSpaceMatrix = lightSpaceMatrix;
+
+        // the packet is rendered with the view of a later frame, the meshes it reveals at the edges
+        // must not be culled
+        const float fovy = projection.fovy + (latency ? pipeline.cullingMargin : 0.f);
+        packet.frustum = createFrustum(camera.pos, camera.up, camera.dir, fovy, projection.aspect, projection.near,
+                                       projection.far);
+
+        std::unique_lock<std::mutex> lock(pipeline.mutex);
+        ++pipeline.submitted;
+        pipeline.cv.notify_all();
+
+        // the packets before it are overwritten by the next submissions
+        const int target = max(pipeline.submitted - latency, 1);
+        const double start = glfwGetTime();
+        pipeline.cv.wait(lock, [target] { return pipeline.completed >= target; });
+        pipeline.waitMs = (glfwGetTime() - start) * 1000.0;
+        renderIndex = pipeline.completed - 1;
+    }
+
+    // the render stage
+    const FramePacket& packet = pipeline.packets[renderIndex % pipeline.PACKET_COUNT];
+    const std::vector<Model>& activeModels = *packet.models;
+    const int instanceCount = packet.visible.size();
+
+    const bool occlusionQueries = config.occlusionCulling == OCCLUSION_QUERIES;
+    const int prevOcclusion = !occlusion.current;
+
+    if(occlusionQueries)
+    {
+        QueryPool* pools[] = {&occlusion.gbuffer, &occlusion.shadow};
+
+        for(QueryPool* pool: pools)
+        {
+            for(int i = 0; i < 2; ++i)
+            {
+                const bool resize = pool->queries[i].size() != instanceCount;
+
+                if(resize)
+                {
+                    glDeleteQueries(pool->queries[i].size(), pool->queries[i].data());
+                    pool->queries[i].resize(instanceCount);
+                    glGenQueries(instanceCount, pool->queries[i].data());
+                    pool->predicates[i].resize(instanceCount);
+                }
+
+                // results from before the queries were disabled are stale
+                if(resize || !occlusion.enabled)
+                {
+                    for(GLuint& predicate: pool->predicates[i])
+                        predicate = 0;
+                }
+            }
+        }
+    }
+
+    auto isExpensive = [&](const Model& model, const Mesh& mesh)
+    {
+        return model.idxSkeleton || mesh.numIndices >= config.occlusionQueryMinIndices;
+    };
+
+    // renders bounding boxes of the expensive mesh instances with depth writes disabled;
+    // cameraView - false for the shadow pass
+    auto issueOcclusionQueries = [&](QueryPool& pool, Shader& shader, bool cameraView)
+    {
+        Array<GLuint>& queries = pool.queries[occlusion.current];
+        Array<GLuint>& predicates = pool.predicates[occlusion.current];
+
+        // these were the conditions of the previous frame; never wait for the results
+        pool.conditional = 0;
+        pool.skipped = 0;
+
+        for(GLuint predicate: predicates)
+        {
+            if(!predicate)
+                continue;
+
+            ++pool.conditional;
+            GLuint available;
+            glGetQueryObjectuiv(predicate, GL_QUERY_RESULT_AVAILABLE, &available);
+
+            if(available)
+            {
+                GLuint passed;
+                glGetQueryObjectuiv(predicate, GL_QUERY_RESULT, &passed);
+                pool.skipped += !passed;
+            }
+        }
+
+        glDepthMask(GL_FALSE);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthFunc(GL_LEQUAL);
+        glDisable(GL_CULL_FACE);
+        shader.bind();
+        glBindVertexArray(cube.vao);
+
+        int idxInstance = 0;
+
+        for(const Model& model: activeModels)
+        {
+            for(int i = 0; i < model.meshCount; ++i, ++idxInstance)
+            {
+                const Mesh& mesh = meshes[model.idxMesh + i];
+                predicates[idxInstance] = 0;
+
+                if(!isExpensive(model, mesh))
+                    continue;
+
+                if(cameraView)
+                {
+                    if(!packet.visible[idxInstance])
+                        continue;
+
+                    // the near plane would clip the box and the query could fail
+                    if(isInside(activeCamera.pos, packet.instances[idxInstance].bounds, model.transform, projection.near * 2.f))
+                        continue;
+                }
+
+                const vec3 bboxMin = packet.instances[idxInstance].bounds.vertices[0];
+                const vec3 bboxMax = packet.instances[idxInstance].bounds.vertices[7];
+                shader.uniformMat4("model", model.transform * translate(bboxMin) * scale(bboxMax - bboxMin));
+
+                glBeginQuery(GL_ANY_SAMPLES_PASSED, queries[idxInstance]);
+                glDrawArrays(GL_TRIANGLES, 0, 36);
+                glEndQuery(GL_ANY_SAMPLES_PASSED);
+
+                predicates[idxInstance] = queries[idxInstance];
+            }
+        }
+
+        glDepthMask(GL_TRUE);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDepthFunc(GL_LESS);
+    };
+
+
+    // the palettes of the packet were built for its skinning settings
+    const bool cpuSkinning = packet.settings.skinningBackend == SKINNING_BACKEND_CPU;
+    const int skinningFormat = packet.skinning;
+
+    // shared by the shadow and gbuffer passes
+    if(packet.paletteSize && !cpuSkinning)
+    {
+        glBindBuffer(GL_TEXTURE_BUFFER, poseCache.bo);
+        glBufferData(GL_TEXTURE_BUFFER, sizeof(vec4) * packet.paletteSize, packet.palettes.data(), GL_STREAM_DRAW);
+    }
+
+    glActiveTexture(GL_TEXTURE0 + UNIT_BONES);
+    glBindTexture(GL_TEXTURE_BUFFER, poseCache.texture);
+
+    const bool skinningPrePass = cpuSkinning ||
+                                 (packet.settings.skinningBackend == SKINNING_BACKEND_TRANSFORM_FEEDBACK &&
+                                  skinning.shader.programId);
+
+    if(cpuSkinning && packet.skinnedSize)
+    {
+        const double start = glfwGetTime();
+        const int chunkSize = 1024; // vertices per task
+        FrameArray<SkinningJob> jobs;
+
+        for(int idxModel: packet.skinnedModels)
+        {
+            const Model& model = activeModels[idxModel];
+
+            for(int i = 0; i < model.meshCount; ++i)
+            {
+                const Mesh& mesh = meshes[model.idxMesh + i];
+                const InstanceState& instance = packet.instances[packet.firstInstances[idxModel] + i];
+                const vec4* palette = &packet.palettes[instance.paletteOffset];
+
+                for(int first = 0; first < mesh.vertexCount; first += chunkSize)
+                {
+                    jobs.pushBack({&bindVertices[mesh.bindVertexOffset + first],
+                                   min(chunkSize, mesh.vertexCount - first), palette, instance.baseVertex + first});
+                }
+            }
+        }
+
+        const GLsizeiptr size = sizeof(SkinnedVertex) * packet.skinnedSize;
+        glBindBuffer(GL_ARRAY_BUFFER, skinning.bo);
+        glBufferData(GL_ARRAY_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        SkinnedVertex* const skinned = (SkinnedVertex*)glMapBufferRange(GL_ARRAY_BUFFER, 0, size,
+                                                                        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+
+        if(skinned)
+        {
+            auto skin = [&](int begin, int end)
+            {
+                for(int i = begin; i < end; ++i)
+                {
+                    const SkinningJob& job = jobs[i];
+                    skinVertices(job.vertices, job.count, job.palette, skinned + job.first);
+                }
+            };
+
+            jobSystem.parallelFor(jobs.size(), 1, skin);
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+        }
+
+        skinning.cpuMs = (glfwGetTime() - start) * 1000.0;
+    }
+
+    if(skinningPrePass && !cpuSkinning && packet.skinnedSize)
+    {
+        glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, skinning.bo);
+        glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER, sizeof(SkinnedVertex) * packet.skinnedSize, nullptr,
+                     GL_STREAM_COPY);
+
+        glEnable(GL_RASTERIZER_DISCARD);
+        skinning.shader.bind();
+        skinning.shader.uniform1i("dualQuaternions", skinningFormat == SKINNING_DUAL_QUAT);
+
+        for(int idxModel: packet.skinnedModels)
+        {
+            const Model& model = activeModels[idxModel];
+
+            for(int i = 0; i < model.meshCount; ++i)
+            {
+                const Mesh& mesh = meshes[model.idxMesh + i];
+                const InstanceState& instance = packet.instances[packet.firstInstances[idxModel] + i];
+
+                skinning.shader.uniform1i("paletteOffset", instance.paletteOffset);
+                glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, skinning.bo,
+                                  sizeof(SkinnedVertex) * instance.baseVertex,
+                                  sizeof(SkinnedVertex) * mesh.vertexCount);
+
+                glBindVertexArray(mesh.vao);
+                glBeginTransformFeedback(GL_POINTS);
+                glDrawArrays(GL_POINTS, 0, mesh.vertexCount);
+                glEndTransformFeedback();
+            }
+        }
+
+        glDisable(GL_RASTERIZER_DISCARD);
+    }
+
+    const int crowdCount = crowd.available && config.crowd ? min(config.crowdCount, int(crowd.MAX_COUNT)) : 0;
+
+    if(crowdCount)
+    {
+        const float duration = skeletons[crowd.prototype.idxSkeleton].animations[crowd.prototype.currentAnimation].duration;
+
+        for(int i = 0; i < crowdCount; ++i)
+            crowd.times[i] = fmod(crowd.times[i] + frame.dt, duration);
+
+        glBindBuffer(GL_ARRAY_BUFFER, crowd.timeBo);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(float) * crowd.times.size(), nullptr, GL_STREAM_DRAW); // orphan
+        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(float) * crowdCount, crowd.times.data());
+    }
+
+    auto bindMaterial = [&](Shader& shader, const Material& material)
+    {
+        shader.uniform3f("colorDiffuse", outputView == VIEW_WIREFRAME ? vec3(1.f) : material.colorDiffuse);
+        shader.uniform3f("colorSpecular", material.colorSpecular);
+        shader.uniform1i("mapDiffuse", material.idxDiffuse && outputView != VIEW_WIREFRAME);
+        shader.uniform1i("mapSpecular", material.idxSpecular);
+        shader.uniform1i("mapNormal", material.idxNormal && config.normalMaps);
+        shader.uniform1i("alphaTest", material.alphaTest);
+
+        if(material.idxDiffuse)
+        {
+            if(config.debugUvs)
+                bindTexture(textures[0], UNIT_DIFFUSE);
+
+            else if(config.srgbDiffuseTextures)
+                bindTexture(textures[material.idxDiffuse_srgb], UNIT_DIFFUSE);
+
+            else
+                bindTexture(textures[material.idxDiffuse], UNIT_DIFFUSE);
+        }
+
+        if(material.idxSpecular)
+            bindTexture(textures[material.idxSpecular], UNIT_SPECULAR);
+
+        if(material.idxNormal)
+            bindTexture(textures[material.idxNormal], UNIT_NORMAL);
+    };
+
+    // the crowd is not culled; shader must be bound, withMaterials - for the gbuffer pass
+    auto drawCrowd = [&](Shader& shader, bool withMaterials)
+    {
+        const Model& prototype = crowd.prototype;
+        const int idxClip = prototype.currentAnimation;
+
+        shader.uniform1i("clipRow", crowd.baked.clipRows[idxClip]);
+        shader.uniform1i("frameCount", crowd.baked.clipFrames[idxClip]);
+        shader.uniform1f("duration", skeletons[prototype.idxSkeleton].animations[idxClip].duration);
+        bindTexture(crowd.texture, UNIT_BAKED_ANIMATION);
+
+        for(int i = 0; i < prototype.meshCount; ++i)
+        {
+            const Mesh& mesh = meshes[prototype.idxMesh + i];
+
+            if(withMaterials)
+                bindMaterial(shader, materials[mesh.idxMaterial]);
+
+            shader.uniform1i("paletteStart", mesh.paletteStart);
+            glBindVertexArray(mesh.vao);
+            glDrawElementsInstanced(withMaterials && outputView == VIEW_WIREFRAME ? GL_LINES : GL_TRIANGLES,
+                                    mesh.numIndices, GL_UNSIGNED_INT,
+                                    reinterpret_cast<const void*>(mesh.indicesOffset), crowdCount);
+        }
+    };
+
+    int numContributionCulled = 0;
+    int numContributionCulledShadow = 0;
+
+    // render shadow map
+    if(outputView == VIEW_FINAL || outputView == VIEW_SHADOWMAP)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, shadowMap.framebuffer);
+        glClear(GL_DEPTH_BUFFER_BIT);
+
+        if(config.shadows)
+        {
+            glViewport(0, 0, ShadowMap::SIZE, ShadowMap::SIZE);
+            glEnable(GL_DEPTH_TEST);
+            glEnable(GL_CULL_FACE);
+
+            Shader* shaders[] = {&shadowMap.shader, &shadowMap.shaderAnim};
+
+            for(Shader* shader: shaders)
+            {
+                shader->bind();
+                shader->uniformMat4("lightSpaceMatrix", lightSpaceMatrix);
+            }
+
+            const GLuint* conditions = occlusionQueries ? occlusion.shadow.predicates[prevOcclusion].data() :
+                                                          nullptr;
+            int idxInstance = 0;
+            const vec2 shadowMapSize = vec2(ShadowMap::SIZE);
+
+            for(const Model& model: activeModels)
+            {
+                const bool preSkinned = model.idxSkeleton && skinningPrePass;
+                const bool skinned = model.idxSkeleton && !skinningPrePass;
+                Shader& shader = skinned ? shadowMap.shaderAnim : shadowMap.shader;
+                shader.bind();
+
+                if(skinned)
+                    shader.uniform1i("dualQuaternions", skinningFormat == SKINNING_DUAL_QUAT);
+
+                shader.uniformMat4("model", model.transform);
+
+                const mat4 mvp = lightSpaceMatrix * model.transform;
+
+                for(int i = 0; i < model.meshCount; ++i, ++idxInstance)
+                {
+                    const Mesh& mesh = meshes[model.idxMesh + i];
+                    assert(mesh.indicesOffset);
+
+                    if(config.contributionCulling &&
+                       projectedArea(packet.instances[idxInstance].bounds, mvp, shadowMapSize) < config.minPixelsShadow)
+                    {
+                        ++numContributionCulledShadow;
+                        continue;
+                    }
+
+                    glBindVertexArray(preSkinned ? mesh.skinnedVao : mesh.vao);
+
+                    if(skinned)
+                        shader.uniform1i("paletteOffset", packet.instances[idxInstance].paletteOffset);
+
+                    const bool conditional = conditions && conditions[idxInstance];
+
+                    if(conditional)
+                        glBeginConditionalRender(conditions[idxInstance], GL_QUERY_NO_WAIT);
+
+                    // the pre-pass output of all palettes shares one buffer
+                    glDrawElementsBaseVertex(GL_TRIANGLES, mesh.numIndices, GL_UNSIGNED_INT,
+                                             reinterpret_cast<const void*>(mesh.indicesOffset),
+                                             preSkinned ? packet.instances[idxInstance].baseVertex : 0);
+
+                    if(conditional)
+                        glEndConditionalRender();
+                }
+            }
+
+            if(occlusionQueries)
+                issueOcclusionQueries(occlusion.shadow, shadowMap.shader, false);
+
+            if(crowdCount)
+            {
+                crowd.shaderShadow.bind();
+                crowd.shaderShadow.uniformMat4("lightSpaceMatrix", lightSpaceMatrix);
+                drawCrowd(crowd.shaderShadow, false);
+            }
+        }
+    }
+
+    // the shadow map was not rendered, the queries of the previous frame are stale
+    if(occlusionQueries && !(config.shadows && (outputView == VIEW_FINAL || outputView == VIEW_SHADOWMAP)))
+    {
+        for(Array<GLuint>& predicates: occlusion.shadow.predicates)
+        {
+            for(GLuint& predicate: predicates)
+                predicate = 0;
+        }
+    }
+
+    // render gbuffer
+    int numMesh = 0;
+    int maxMesh = 0;
+    {
+        const bool hizCulling = config.occlusionCulling == OCCLUSION_HIZ && hiz.available;
+        maxMesh = instanceCount;
+
+        if(hizCulling && hiz.instances.size() != instanceCount)
+        {
+            for(Array<GLuint>& queries: hiz.queriesVisible)
+            {
+                glDeleteQueries(queries.size(), queries.data());
+                queries.resize(instanceCount);
+                glGenQueries(instanceCount, queries.data());
+            }
+
+            glDeleteQueries(hiz.queriesNew.size(), hiz.queriesNew.data());
+            hiz.queriesNew.resize(instanceCount);
+            glGenQueries(instanceCount, hiz.queriesNew.data());
+
+            hiz.instances.resize(instanceCount);
+            hiz.gridSize = ivec2(Hiz::GRID_WIDTH, (instanceCount + Hiz::GRID_WIDTH - 1) / Hiz::GRID_WIDTH);
+
+            for(GLuint texture: hiz.visibility)
+            {
+                glBindTexture(GL_TEXTURE_2D, texture);
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, hiz.gridSize.x, hiz.gridSize.y, 0, GL_RED,
+                        GL_UNSIGNED_BYTE, nullptr);
+            }
 
-        if(config.shadows)
-        {
-            glViewport(0, 0, ShadowMap::SIZE, ShadowMap::SIZE);
-            glEnable(GL_DEPTH_TEST);
-            glEnable(GL_CULL_FACE);
+            hiz.historyValid = false;
+        }
 
-            Shader* shaders[] = {&shadowMap.shader, &shadowMap.shaderAnim};
+        if(!hizCulling)
+            hiz.historyValid = false;
+
+        // conditions - per instance occlusion queries (0 - no condition),
+        // nullptr renders unconditionally
+        auto renderMeshes = [&](const GLuint* conditions, GLenum conditionMode, bool countMeshes)
+        {
+            Shader* shaders[] = {&gbuffer.shader, &gbuffer.shaderAnim};
 
             for(Shader* shader: shaders)
             {
                 shader->bind();
-                shader->uniformMat4("lightSpaceMatrix", lightSpaceMatrix);
+                shader->uniformMat4("view", activeCamera.view);
+                shader->uniformMat4("projection", projection.matrix);
             }
 
+            int idxInstance = 0;
+
             for(const Model& model: activeModels)
             {
-                Shader& shader = model.idxSkeleton ? shadowMap.shaderAnim : shadowMap.shader;
+                const bool preSkinned = model.idxSkeleton && skinningPrePass;
+                const bool skinned = model.idxSkeleton && !skinningPrePass;
+                Shader& shader = skinned ? gbuffer.shaderAnim : gbuffer.shader;
                 shader.bind();
 
-                if(model.idxSkeleton)
-                    shader.uniformMat4v("bones", model.boneTransformations.size(), model.boneTransformations.data());
+                if(skinned)
+                    shader.uniform1i("dualQuaternions", skinningFormat == SKINNING_DUAL_QUAT);
 
-                shadowMap.shader.uniformMat4("model", model.transform);
+                shader.uniformMat4("model", model.transform);
 
-                for(int i = 0; i < model.meshCount; ++i)
+                const mat4 mvp = projection.matrix * activeCamera.view * model.transform;
+
+                for(int i = 0; i < model.meshCount; ++i, ++idxInstance)
                 {
                     const Mesh& mesh = meshes[model.idxMesh + i];
-                    assert(mesh.indicesOffset);
-                    glBindVertexArray(mesh.vao);
 
-                    glDrawElements(GL_TRIANGLES, mesh.numIndices, GL_UNSIGNED_INT,
-                            reinterpret_cast<const void*>(mesh.indicesOffset));
+                    if(!packet.visible[idxInstance])
+                        continue;
+
+                    if(config.contributionCulling &&
+                       projectedArea(packet.instances[idxInstance].bounds, mvp, vec2(frame.bufferSize)) < config.minPixels)
+                    {
+                        numContributionCulled += countMeshes;
+                        continue;
+                    }
+
+                    numMesh += countMeshes;
+
+                    bindMaterial(shader, materials[mesh.idxMaterial]);
+
+                    if(skinned)
+                        shader.uniform1i("paletteOffset", packet.instances[idxInstance].paletteOffset);
+
+                    const bool conditional = conditions && conditions[idxInstance];
+
+                    if(conditional)
+                        glBeginConditionalRender(conditions[idxInstance], conditionMode);
+
+                    glBindVertexArray(preSkinned ? mesh.skinnedVao : mesh.vao);
+                    glDrawElementsBaseVertex(outputView == VIEW_WIREFRAME ? GL_LINES : GL_TRIANGLES, mesh.numIndices,
+                                             GL_UNSIGNED_INT, reinterpret_cast<const void*>(mesh.indicesOffset),
+                                             preSkinned ? packet.instances[idxInstance].baseVertex : 0);
+
+                    if(conditional)
+                        glEndConditionalRender();
                 }
             }
-        }
-    }
+        };
 
-    // render gbuffer
-    int numMesh = 0;
-    int maxMesh = 0;
-    {
         glBindFramebuffer(GL_FRAMEBUFFER, gbuffer.framebuffer);
         glViewport(0, 0, frame.bufferSize.x, frame.bufferSize.y);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         glEnable(GL_DEPTH_TEST);
         glEnable(GL_CULL_FACE);
 
-        Shader* shaders[] = {&gbuffer.shader, &gbuffer.shaderAnim};
-
-        for(Shader* shader: shaders)
+        if(occlusionQueries)
         {
-            shader->bind();
-            shader->uniformMat4("view", activeCamera.view);
-            shader->uniformMat4("projection", projection.matrix);
-        }
+            renderMeshes(occlusion.gbuffer.predicates[prevOcclusion].data(), GL_QUERY_NO_WAIT, true);
 
-        for(Model& model: activeModels)
+            shaderPlainColor.bind();
+            shaderPlainColor.uniformMat4("view", activeCamera.view);
+            shaderPlainColor.uniformMat4("projection", projection.matrix);
+            issueOcclusionQueries(occlusion.gbuffer, shaderPlainColor, true);
+        }
+        else if(!hizCulling)
+            renderMeshes(nullptr, 0, true);
+        else
         {
-            Shader& shader = model.idxSkeleton ? gbuffer.shaderAnim : gbuffer.shader;
-            shader.bind();
+            const int prev = !hiz.current;
 
-            if(model.idxSkeleton)
-                shader.uniformMat4v("bones", model.boneTransformations.size(), model.boneTransformations.data());
+            // first phase; the results of the previous frame should already be available,
+            // if not the meshes are rendered
+            if(hiz.historyValid)
+                renderMeshes(hiz.queriesVisible[prev].data(), GL_QUERY_NO_WAIT, false);
 
-            shader.uniformMat4("model", model.transform);
+            glDisable(GL_DEPTH_TEST);
+            glDisable(GL_CULL_FACE);
 
-            for(int i = 0; i < model.meshCount; ++i)
+            // build the pyramid
             {
-                const Mesh& mesh = meshes[model.idxMesh + i];
-                ++maxMesh;
+                glBindFramebuffer(GL_FRAMEBUFFER, hiz.framebuffer);
+                hiz.shaderBuild.bind();
+                glBindVertexArray(quad.vao);
+                ivec2 levelSize = frame.bufferSize;
 
-                if(config.frustumCulling && cull(frustum, mesh.bbox, model.transform))
-                    continue;
+                for(int level = 0; level < hiz.levelCount; ++level)
+                {
+                    if(level == 0)
+                        bindTexture(gbuffer.depthBuffer, UNIT_DEFAULT);
+                    else
+                    {
+                        // sample only the previous level, the one we render to must be excluded
+                        bindTexture(hiz.texture, UNIT_DEFAULT);
+                        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+                        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+                    }
+
+                    levelSize = ivec2(max(levelSize.x / 2, 1), max(levelSize.y / 2, 1));
+                    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                            hiz.texture, level);
+                    glViewport(0, 0, levelSize.x, levelSize.y);
+                    glDrawArrays(GL_TRIANGLES, 0, 6);
+                }
+
+                bindTexture(hiz.texture, UNIT_DEFAULT);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, hiz.levelCount - 1);
+            }
 
-                ++numMesh;
+            // test
+            {
+                int idxInstance = 0;
+                for(const Model& model: activeModels)
+                {
+                    for(int i = 0; i < model.meshCount; ++i, ++idxInstance)
+                    {
+                        const BoundingBox& bbox = packet.instances[idxInstance].bounds;
+                        hiz.instances[idxInstance] = {bbox.vertices[0], bbox.vertices[7], model.transform};
+                    }
+                }
 
-                const Material& material = materials[mesh.idxMaterial];
+                glBindBuffer(GL_ARRAY_BUFFER, hiz.bo);
+                glBufferData(GL_ARRAY_BUFFER, sizeof(HizInstance) * instanceCount, hiz.instances.data(),
+                        GL_STREAM_DRAW);
 
-                shader.uniform3f("colorDiffuse", outputView == VIEW_WIREFRAME ? vec3(1.f) : material.colorDiffuse);
-                shader.uniform3f("colorSpecular", material.colorSpecular);
-                shader.uniform1i("mapDiffuse", material.idxDiffuse && outputView != VIEW_WIREFRAME);
-                shader.uniform1i("mapSpecular", material.idxSpecular);
-                shader.uniform1i("mapNormal", material.idxNormal && config.normalMaps);
-                shader.uniform1i("alphaTest", material.alphaTest);
+                glBindFramebuffer(GL_FRAMEBUFFER, hiz.visibilityFramebuffer[hiz.current]);
+                glViewport(0, 0, hiz.gridSize.x, hiz.gridSize.y);
+                glClear(GL_COLOR_BUFFER_BIT);
 
-                if(material.idxDiffuse)
+                // without history nothing was rendered in the first phase
+                if(!hiz.historyValid)
                 {
-                    if(config.debugUvs)
-                        bindTexture(textures[0], UNIT_DIFFUSE);
+                    glBindFramebuffer(GL_FRAMEBUFFER, hiz.visibilityFramebuffer[prev]);
+                    glClear(GL_COLOR_BUFFER_BIT);
+                    glBindFramebuffer(GL_FRAMEBUFFER, hiz.visibilityFramebuffer[hiz.current]);
+                }
 
-                    else if(config.srgbDiffuseTextures)
-                        bindTexture(textures[material.idxDiffuse_srgb], UNIT_DIFFUSE);
+                hiz.shaderTest.bind();
+                hiz.shaderTest.uniformMat4("viewProjection", projection.matrix * activeCamera.view);
+                hiz.shaderTest.uniform2i("gridSize", hiz.gridSize);
+                bindTexture(hiz.texture, UNIT_HIZ);
+                bindTexture(hiz.visibility[prev], UNIT_VISIBILITY);
+                glBindVertexArray(hiz.vao);
 
-                    else
-                        bindTexture(textures[material.idxDiffuse], UNIT_DIFFUSE);
+                hiz.shaderTest.uniform1i("secondChance", 0);
+
+                for(int i = 0; i < instanceCount; ++i)
+                {
+                    glBeginQuery(GL_ANY_SAMPLES_PASSED, hiz.queriesVisible[hiz.current][i]);
+                    glDrawArrays(GL_POINTS, i, 1);
+                    glEndQuery(GL_ANY_SAMPLES_PASSED);
                 }
 
-                if(material.idxSpecular)
-                    bindTexture(textures[material.idxSpecular], UNIT_SPECULAR);
+                hiz.shaderTest.uniform1i("secondChance", 1);
+                glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
 
-                if(material.idxNormal)
-                    bindTexture(textures[material.idxNormal], UNIT_NORMAL);
+                for(int i = 0; i < instanceCount; ++i)
+                {
+                    glBeginQuery(GL_ANY_SAMPLES_PASSED, hiz.queriesNew[i]);
+                    glDrawArrays(GL_POINTS, i, 1);
+                    glEndQuery(GL_ANY_SAMPLES_PASSED);
+                }
 
-                glBindVertexArray(mesh.vao);
-                glDrawElements(outputView == VIEW_WIREFRAME ? GL_LINES : GL_TRIANGLES, mesh.numIndices,
-                               GL_UNSIGNED_INT, reinterpret_cast<const void*>(mesh.indicesOffset));
+                glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
             }
+
+            // second phase; the gpu waits for the test results, cpu does not
+            glBindFramebuffer(GL_FRAMEBUFFER, gbuffer.framebuffer);
+            glViewport(0, 0, frame.bufferSize.x, frame.bufferSize.y);
+            glEnable(GL_DEPTH_TEST);
+            glEnable(GL_CULL_FACE);
+            renderMeshes(hiz.queriesNew.data(), GL_QUERY_WAIT, true);
+
+            hiz.current = prev;
+            hiz.historyValid = true;
+        }
+
+        if(crowdCount)
+        {
+            crowd.shader.bind();
+            crowd.shader.uniformMat4("view", activeCamera.view);
+            crowd.shader.uniformMat4("projection", projection.matrix);
+            drawCrowd(crowd.shader, true);
         }
     }
 
+    if(occlusionQueries)
+        occlusion.current = prevOcclusion;
+
+    occlusion.enabled = occlusionQueries;
+
     // render ssao
     if(config.ssao)
     {
@@ -1049,18 +2710,9 @@ void renderExecuteFrame(const Frame& frame)
                 camera.pos, frustum.farLeftTop, frustum.farRightTop
             };
 
-            GLuint vao;
-            GLuint bo;
-
-            glGenVertexArrays(1, &vao);
-            glGenBuffers(1, &bo);
-
-            glBindBuffer(GL_ARRAY_BUFFER, bo);
-            glBufferData(GL_ARRAY_BUFFER, sizeof vertices, vertices, GL_STATIC_DRAW);
-
-            glBindVertexArray(vao);
-            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
-            glEnableVertexAttribArray(0);
+            glBindBuffer(GL_ARRAY_BUFFER, debugFrustum.bo);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof vertices, vertices);
+            glBindVertexArray(debugFrustum.vao);
 
             glDisable(GL_CULL_FACE);
             glEnable(GL_BLEND);
@@ -1076,9 +2728,32 @@ void renderExecuteFrame(const Frame& frame)
                 glDrawArrays(GL_LINE_LOOP, i * 3, 3);
 
             glDepthMask(GL_TRUE);
+        }
+
+        if(pvs.debugGrid && pvs.lineVertexCount)
+        {
+            shaderPlainColor.uniformMat4("model", mat4());
+            shaderPlainColor.uniform3f("color", vec3(1.f, 1.f, 0.f));
+            glBindVertexArray(pvs.vao);
+            glDrawArrays(GL_LINES, 0, pvs.lineVertexCount);
 
-            glDeleteVertexArrays(1, &vao);
-            glDeleteBuffers(1, &bo);
+            const int cell = getPvsCell(pvs.pvs, camera.pos);
+
+            if(cell != -1)
+            {
+                const ivec3 gridSize = pvs.pvs.gridSize;
+                const ivec3 coord(cell % gridSize.x, (cell / gridSize.x) % gridSize.y,
+                                  cell / (gridSize.x * gridSize.y));
+
+                shaderPlainColor.uniformMat4("model", translate(pvs.pvs.gridMin + vec3(coord) * pvs.pvs.cellSize) *
+                                                      scale(vec3(pvs.pvs.cellSize)));
+                shaderPlainColor.uniform3f("color", vec3(1.f, 0.f, 0.f));
+                glDisable(GL_CULL_FACE);
+                glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+                glBindVertexArray(cube.vao);
+                glDrawArrays(GL_TRIANGLES, 0, 36);
+                glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+            }
         }
     }
 
@@ -1172,7 +2847,265 @@ void renderExecuteFrame(const Frame& frame)
     ImGui::SliderFloat("ssao radius", &ssao.radius, 0.f, 50.f);
     ImGui::Checkbox("debug UV diffuse texture", &config.debugUvs);
     ImGui::Checkbox("frustum culling", &config.frustumCulling);
+
+    if(config.frustumCulling)
+    {
+        ImGui::Checkbox("temporally coherent culling", &config.coherentCulling);
+
+        if(packet.cullingReused)
+            ImGui::Text("static view, reusing the last frustum culling results");
+        else if(packet.skipInside)
+            ImGui::Text("frustum barely moved, skipping containing planes");
+    }
+
+    ImGui::Checkbox("pvs (static scene)", &config.pvs);
+
+    if(config.pvs)
+    {
+        if(packet.pvsCell != -1)
+            ImGui::Text("pvs cell %d, culled %d meshes", packet.pvsCell, packet.numPvsCulled);
+        else
+            ImGui::Text(pvs.pvs.cellOffsets.empty() ? "pvs not built" : "camera is outside of the pvs grid");
+
+        ImGui::Checkbox("pvs debug grid", &pvs.debugGrid);
+        ImGui::SliderFloat("pvs cell size", &pvs.cellSize, 50.f, 1000.f);
+        ImGui::SliderFloat("pvs walkable height", &pvs.walkableHeight, 100.f, 3000.f);
+        ImGui::SliderInt("pvs rays per cell", &pvs.raysPerCell, 256, 65536);
+
+        if(ImGui::Button("build pvs"))
+        {
+            finishSimulation();
+
+            if(buildScenePvs(pvs.pvs, models, meshes, pvs.cellSize, pvs.walkableHeight, pvs.raysPerCell))
+            {
+                if(savePvs(pvs.pvs, pvs.filename))
+                    log("saved %s", pvs.filename);
+
+                pvs.lineVertexCount = uploadPvsGrid(pvs.pvs, pvs.bo);
+                culling.pvsCell = -1; // force decompression
+                culling.lastValid = false; // the visible set was computed from the old bits
+            }
+        }
+    }
+
+    ImGui::Checkbox("contribution culling", &config.contributionCulling);
+
+    if(config.contributionCulling)
+    {
+        ImGui::SliderFloat("min pixels", &config.minPixels, 0.f, 1000.f, "%.1f", 3.f);
+        ImGui::SliderFloat("min pixels shadow", &config.minPixelsShadow, 0.f, 1000.f, "%.1f", 3.f);
+        ImGui::Text("contribution culled: gbuffer %d, shadow %d", numContributionCulled,
+                    numContributionCulledShadow);
+    }
+
+    {
+        const char* occlusionItems[OCCLUSION_COUNT] = {
+            "off",
+            "gpu hi-z",
+            "hardware queries (expensive meshes)"
+        };
+
+        ImGui::ListBox("occlusion culling", &config.occlusionCulling, occlusionItems,
+                       OCCLUSION_COUNT, OCCLUSION_COUNT + 1);
+
+        if(config.occlusionCulling == OCCLUSION_HIZ && !hiz.available)
+            ImGui::Text("hi-z is not available, using cpu culling only");
+
+        if(config.occlusionCulling == OCCLUSION_QUERIES)
+        {
+            ImGui::SliderInt("query min indices", &config.occlusionQueryMinIndices, 0, 100000);
+            ImGui::Text("gbuffer: skipped %d out of %d conditional draws", occlusion.gbuffer.skipped,
+                        occlusion.gbuffer.conditional);
+            ImGui::Text("shadow:  skipped %d out of %d conditional draws", occlusion.shadow.skipped,
+                        occlusion.shadow.conditional);
+        }
+    }
+
     ImGui::Checkbox("test scene", &config.testScene);
+
+    if(crowd.available)
+    {
+        ImGui::Checkbox("goblin crowd (baked animation)", &config.crowd);
+
+        if(config.crowd)
+            ImGui::SliderInt("crowd size", &config.crowdCount, 1, crowd.MAX_COUNT);
+    }
+
+    ImGui::SliderInt("threads", &config.threads, 1, 16);
+    ImGui::SliderInt("max frame latency", &pipeline.maxLatency, 0, pipeline.PACKET_COUNT - 1);
+
+    if(pipeline.maxLatency)
+        ImGui::SliderFloat("culling fovy margin", &pipeline.cullingMargin, 0.f, 30.f);
+
+    ImGui::Text("simulation %.3f ms, render thread waited %.3f ms, %d frames behind the input",
+                packet.simulationMs, pipeline.waitMs, pipeline.submitted - 1 - renderIndex);
+
+    ImGui::Text("heap calls in the last frame: %d allocations, %d frees",
+                int(heapCalls.allocations[getSize(heapCalls.allocations) - 1]), heapCalls.frees);
+    ImGui::PlotLines("heap allocations", heapCalls.allocations, getSize(heapCalls.allocations), 0, nullptr, 0.f,
+                     FLT_MAX, {0, 60});
+    ImGui::Text("frame arenas: render %.1f KB, simulation %.1f KB", getFrameArena().getUsed() / 1024.f,
+                packet.arenaUsed / 1024.f);
+    ImGui::Checkbox("pose cache", &config.poseCache);
+
+    if(config.poseCache)
+        ImGui::SliderFloat("pose time step", &config.poseTimeStep, 1.f / 240.f, 1.f / 10.f, "%.4f");
+
+    ImGui::SliderInt("phase buckets", &config.phaseBuckets, 0, 32);
+    ImGui::Checkbox("animation lod", &config.animationLod);
+
+    if(config.animationLod)
+    {
+        ImGui::SliderFloat("1/2 rate distance", &config.lodHalfRateDistance, 0.f, 10000.f);
+        ImGui::SliderFloat("1/4 rate distance", &config.lodQuarterRateDistance, 0.f, 10000.f);
+        ImGui::Checkbox("reduced bones at 1/2 and 1/4 rate", &config.lodReducedBones);
+    }
+
+    ImGui::Checkbox("animated bounds", &config.animatedBounds);
+
+    if(config.animatedBounds)
+        ImGui::Checkbox("tighten with bone capsules", &config.boneCapsules);
+
+    {
+        const char* skinningItems[SKINNING_COUNT] = {
+            "3x4 matrices",
+            "dual quaternions"
+        };
+
+        ImGui::ListBox("skinning", &config.skinning, skinningItems, SKINNING_COUNT);
+    }
+
+    {
+        const char* backendItems[SKINNING_BACKEND_COUNT] = {
+            "vertex shader, every pass",
+            "transform feedback pre-pass",
+            "cpu pre-pass"
+        };
+
+        ImGui::ListBox("skinning backend", &config.skinningBackend, backendItems, SKINNING_BACKEND_COUNT);
+
+        if(config.skinningBackend == SKINNING_BACKEND_CPU)
+        {
+            ImGui::Text("cpu skinning (%s): %d vertices, %.3f ms, 3x4 matrices only", getSkinningIsa(),
+                        packet.skinnedSize, skinning.cpuMs);
+        }
+    }
+
+    ImGui::Text("bone palettes: %.1f KB per frame", packet.paletteSize * sizeof(vec4) / 1024.f);
+
+    ImGui::Text("animation: %d models, %d poses evaluated (%d reduced), %d reused, %d hidden, %.3f ms",
+                packet.numAnimated, packet.numPoses, packet.numReduced, packet.numReused, packet.numHidden,
+                packet.updateMs);
+
+    ImGui::SliderInt("animated instances", &animationBenchmark.instanceCount, 1, 10000);
+
+    if(ImGui::Button("benchmark skeleton update"))
+    {
+        // skeletons[0] is not used by any model
+        if(skeletons.size() > 1)
+        {
+            finishSimulation();
+
+            for(int i = 0; i < getSize(animationBenchmark.threadCounts); ++i)
+            {
+                jobSystem.start(animationBenchmark.threadCounts[i]);
+                benchmarkSkeletonUpdate(jobSystem, skeletons.back(), animationBenchmark.instanceCount,
+                                        animationBenchmark.frameCount, animationBenchmark.msPerFrame[i]);
+            }
+
+            jobSystem.start(config.threads, 1);
+        }
+        else
+            log("skeleton update benchmark: no animated model is loaded");
+    }
+
+    for(int i = 0; i < getSize(animationBenchmark.threadCounts); ++i)
+    {
+        const double (&ms)[2] = animationBenchmark.msPerFrame[i];
+
+        if(ms[0])
+        {
+            ImGui::Text("skeleton update, %d threads: recursive %.3f ms, flat %.3f ms per frame (x%.2f)",
+                        animationBenchmark.threadCounts[i], ms[0], ms[1], ms[0] / ms[1]);
+        }
+    }
+
+    if(ImGui::Button("benchmark containers"))
+        benchmarkContainers(containerBenchmark.ns, containerBenchmark.heapCalls);
+
+    if(containerBenchmark.ns[0][0])
+    {
+        const char* names[] = {"vertex data, reused", "vertex data, per mesh", "small arrays"};
+
+        for(int i = 0; i < getSize(names); ++i)
+        {
+            ImGui::Text("%s: std::vector %.2f ns, Array %.2f ns, pool %.2f ns, %s %.2f ns", names[i],
+                        containerBenchmark.ns[i][0], containerBenchmark.ns[i][1], containerBenchmark.ns[i][2],
+                        i == 2 ? "SmallArray" : "frame arena", containerBenchmark.ns[i][3]);
+        }
+    }
+
+    if(ImGui::Button("benchmark hash maps"))
+        benchmarkHashMaps(mapBenchmark.ns);
+
+    if(mapBenchmark.ns[0][0])
+    {
+        const char* names[] = {"400 names", "10000 pose keys"};
+
+        for(int i = 0; i < getSize(names); ++i)
+        {
+            ImGui::Text("%s: std::map %.2f ns, std::unordered_map %.2f ns, HashMap %.2f ns", names[i],
+                        mapBenchmark.ns[i][0], mapBenchmark.ns[i][1], mapBenchmark.ns[i][2]);
+        }
+    }
+
+    if(ImGui::Button("benchmark math"))
+        mathBenchmark.passed = benchmarkMath(mathBenchmark.ns, mathBenchmark.maxError);
+
+    if(mathBenchmark.ns[0][0])
+    {
+        const char* names[] = {"transform points", "multiply matrices", "compose TRS"};
+
+        for(int i = 0; i < getSize(names); ++i)
+        {
+            ImGui::Text("%s: scalar %.2f ns, per element %.2f ns, batched %.2f ns, max error %g", names[i],
+                        mathBenchmark.ns[i][0], mathBenchmark.ns[i][1], mathBenchmark.ns[i][2],
+                        mathBenchmark.maxError[i]);
+        }
+
+        if(!mathBenchmark.passed)
+            ImGui::TextColored({1.f, 0.f, 0.f, 1.f}, "the batched kernels differ from the scalar code");
+    }
+
+    if(ImGui::Button("benchmark job system"))
+    {
+        finishSimulation();
+
+        for(int i = 0; i < getSize(jobBenchmark.threadCounts); ++i)
+        {
+            jobSystem.start(jobBenchmark.threadCounts[i]);
+
+            for(int k = 0; k < 2; ++k)
+            {
+                benchmarkJobSystem(jobSystem, jobBenchmark.jobCount, k == 0, jobBenchmark.jobsPerSecond[k][i],
+                                   jobBenchmark.idlePercent[k][i]);
+            }
+        }
+
+        jobSystem.start(config.threads, 1);
+    }
+
+    for(int i = 0; i < getSize(jobBenchmark.threadCounts); ++i)
+    {
+        if(jobBenchmark.jobsPerSecond[0][i])
+        {
+            ImGui::Text("jobs, %d threads: split %.2f M/s (idle %.1f%%), queued %.2f M/s (idle %.1f%%)",
+                        jobBenchmark.threadCounts[i], jobBenchmark.jobsPerSecond[0][i] / 1000000.0,
+                        jobBenchmark.idlePercent[0][i], jobBenchmark.jobsPerSecond[1][i] / 1000000.0,
+                        jobBenchmark.idlePercent[1][i]);
+        }
+    }
+
     ImGui::TextColored({1.f, 0.5f, 0.f, 1.f}, "rendered %d out of %d meshes", numMesh, maxMesh);
 
     const char* cameraItems[] = {
@@ -1221,33 +3154,58 @@ struct BoneLoadData
     mat4 transformFromMeshToBoneSpace;
 };
 
-void createBones(Bone& bone, const aiNode& ainode, const std::map<std::string, BoneLoadData>& boneLoadData)
+// depth-first, parents are added before their children
+// the maps are keyed by the names interned in names
+static void flattenNodes(Skeleton& skeleton, const aiNode& ainode, int parent, StringTable& names,
+                         const HashMap<int, BoneLoadData>& boneLoadData, HashMap<int, int>& nodeIndices)
 {
-    auto it = boneLoadData.find(ainode.mName.C_Str());
+    const int idxNode = skeleton.nodeCount();
+    const int name = names.intern(ainode.mName.C_Str());
+    nodeIndices.insert(name, idxNode);
+
+    mat4 transform;
+    assert(sizeof(ainode.mTransformation) == sizeof(transform));
+    memcpy(&transform[0][0], &ainode.mTransformation[0][0], sizeof(transform));
+
+    skeleton.parents.push_back(parent);
+    skeleton.localTransforms.push_back(transpose(transform));
+    skeleton.inverseBindTransforms.push_back(mat4());
+    skeleton.boneIndices.push_back(MAX_BONES);
+
+    const BoneLoadData* const bone = boneLoadData.find(name);
 
-    // if ainode is animated
-    if(it != boneLoadData.end())
+    // if ainode affects vertices
+    if(bone)
     {
-        bone.idx = it->second.idx;
-        bone.transformFromMeshToBoneSpace = it->second.transformFromMeshToBoneSpace;
+        skeleton.boneIndices.back() = bone->idx;
+        skeleton.inverseBindTransforms.back() = bone->transformFromMeshToBoneSpace;
     }
-    else
+
+    for(int i = 0; i < ainode.mNumChildren; ++i)
+        flattenNodes(skeleton, *ainode.mChildren[i], idxNode, names, boneLoadData, nodeIndices);
+}
+
+// the node referencing the mesh, nullptr if none does
+static const aiNode* findMeshNode(const aiNode& ainode, unsigned idxMesh)
+{
+    for(unsigned i = 0; i < ainode.mNumMeshes; ++i)
     {
-        assert(sizeof(ainode.mTransformation) == sizeof(bone.transform));
-        memcpy(&bone.transform[0][0], &ainode.mTransformation[0][0], sizeof(bone.transform));
-        bone.transform = transpose(bone.transform);
+        if(ainode.mMeshes[i] == idxMesh)
+            return &ainode;
     }
 
-    for(int i = 0; i < ainode.mNumChildren; ++i)
+    for(unsigned i = 0; i < ainode.mNumChildren; ++i)
     {
-        bone.children.push_back({});
-        createBones(bone.children.back(), *ainode.mChildren[i], boneLoadData);
+        if(const aiNode* const node = findMeshNode(*ainode.mChildren[i], idxMesh))
+            return node;
     }
+
+    return nullptr;
 }
 
 static void loadModel(const char* filename, std::vector<Model>& models, Array<Mesh>& meshes,
-                      std::vector<Skeleton>& skeletons, Array<Material>& materials,
-                      Array<GLuint>& textures, Array<TexId>& texIds)
+                      Array<SkinVertex>& bindVertices, std::vector<Skeleton>& skeletons, Array<Material>& materials,
+                      Array<GLuint>& textures, TexIds& texIds)
 {
     char dirpath[256];
     {
@@ -1348,7 +3306,10 @@ static void loadModel(const char* filename, std::vector<Model>& models, Array<Me
 
     Model model;
 
-    std::map<std::string, BoneLoadData> boneLoadData;
+    StringTable names; // of the bones and the nodes
+    HashMap<int, BoneLoadData> boneLoadData;
+    std::vector<const aiNode*> rigidNodes(scene->mNumMeshes, nullptr); // of the skinned meshes without bones
+    HashMap<int, int> rigidBones; // node name -> bone of the meshes of the node without bones
 
     if(scene->HasAnimations())
     {
@@ -1357,30 +3318,88 @@ static void loadModel(const char* filename, std::vector<Model>& models, Array<Me
         Skeleton& skeleton = skeletons.back();
 
         int boneCount = 0;
+        std::vector<float> boneWeights;
+
         for(unsigned idxMesh = 0; idxMesh < scene->mNumMeshes; ++idxMesh)
         {
             const aiMesh& aimesh = *scene->mMeshes[idxMesh];
 
+            // a mesh without bones follows its node rigidly; it gets a bone of its own, the only one of
+            // its palette, on a child node with no offset since the vertices are in the node space, every
+            // vertex weighted by one; the node may be a bone of the other meshes with a different offset
+            if(!aimesh.HasBones())
+            {
+                const aiNode* const ainode = findMeshNode(*scene->mRootNode, idxMesh);
+
+                if(!ainode)
+                    continue;
+
+                bool inserted;
+                const int idx = rigidBones.insert(names.intern(ainode->mName.C_Str()), boneCount, &inserted);
+
+                if(inserted)
+                {
+                    assert(boneCount < MAX_BONES);
+                    ++boneCount;
+                    boneWeights.push_back(0.f);
+                }
+
+                rigidNodes[idxMesh] = ainode;
+                boneWeights[idx] += aimesh.mNumVertices;
+                continue;
+            }
+
             for(int idxBone = 0; idxBone < aimesh.mNumBones; ++idxBone)
             {
                 aiBone& aiBone = *aimesh.mBones[idxBone];
 
-                if(boneLoadData.find(aiBone.mName.C_Str()) == boneLoadData.end())
+                const int name = names.intern(aiBone.mName.C_Str());
+                bool inserted;
+                BoneLoadData& bone = boneLoadData.insert(name, {boneCount, mat4()}, &inserted);
+
+                if(inserted)
                 {
                     assert(boneCount < MAX_BONES);
-                    boneLoadData[aiBone.mName.C_Str()].idx = boneCount;
                     assert(sizeof(mat4) == sizeof(aiMatrix4x4));
-                    mat4& dest = boneLoadData[aiBone.mName.C_Str()].transformFromMeshToBoneSpace;
+                    mat4& dest = bone.transformFromMeshToBoneSpace;
                     memcpy(&dest[0][0], &aiBone.mOffsetMatrix[0][0], sizeof(mat4));
                     dest = transpose(dest); // aiMatrix4x4 is row-major
                     ++boneCount;
+                    boneWeights.push_back(0.f);
                 }
+
+                float& weight = boneWeights[bone.idx];
+
+                for(unsigned idxWeight = 0; idxWeight < aiBone.mNumWeights; ++idxWeight)
+                    weight += aiBone.mWeights[idxWeight].mWeight;
             }
         }
 
-        model.boneTransformations.resize(boneCount);
+        HashMap<int, int> nodeIndices;
+        flattenNodes(skeleton, *(scene->mRootNode), -1, names, boneLoadData, nodeIndices);
 
-        createBones(skeleton.rootBone, *(scene->mRootNode), boneLoadData);
+        // the nodes of the rigid bones go after all the others, they are not animated
+        rigidBones.forEach([&](int name, int idxBone)
+        {
+            skeleton.parents.push_back(*nodeIndices.find(name));
+            skeleton.localTransforms.push_back(mat4());
+            skeleton.inverseBindTransforms.push_back(mat4());
+            skeleton.boneIndices.push_back(idxBone);
+        });
+
+        // bones moving less than 2% of the skin are dropped at the reduced level of detail
+        initReducedNodes(skeleton, boneWeights, 0.02f);
+        log("skeleton: %d nodes, %d at the reduced level of detail", skeleton.nodeCount(),
+            skeleton.reducedNodeCount);
+
+        model.boneCount = boneCount;
+        model.nodeTransforms.resize(skeleton.nodeCount());
+        model.keyCursors.resize(skeleton.nodeCount());
+
+        // import setting, compile time only - the source keys are not kept after loading, so there is
+        // nothing to recompress at runtime; set sampleRate (keys per tick) to resample the clips
+        AnimationCompression animationCompression;
+        animationCompression.sampleRate = 0.f;
 
         for(unsigned idxAnim = 0; idxAnim < scene->mNumAnimations; ++idxAnim)
         {
@@ -1389,13 +3408,16 @@ static void loadModel(const char* filename, std::vector<Model>& models, Array<Me
             Animation animation;
             animation.duration = aianimation.mDuration * 1.f / (aianimation.mTicksPerSecond ? aianimation.mTicksPerSecond : 1.f);
             animation.name = aianimation.mName.C_Str();
+            animation.channelIndices.resize(skeleton.nodeCount(), -1);
+            std::vector<BoneKeys> keys;
 
             for(unsigned idxChannel = 0; idxChannel < aianimation.mNumChannels; ++idxChannel)
             {
                 const aiNodeAnim& ainodeanim = *(aianimation.mChannels[idxChannel]);
 
-                // todo: animation node with no corresponding bones?
-                if(boneLoadData.find(ainodeanim.mNodeName.C_Str()) == boneLoadData.end())
+                const int name = names.find(ainodeanim.mNodeName.C_Str());
+                const int* const idxNode = name == -1 ? nullptr : nodeIndices.find(name);
+                if(!idxNode)
                     continue;
 
                 BoneKeys boneKeys;
@@ -1427,18 +3449,28 @@ static void loadModel(const char* filename, std::vector<Model>& models, Array<Me
                     boneKeys.scaleKeys.push_back(key);
                 }
 
-                int id = boneLoadData.at(ainodeanim.mNodeName.C_Str()).idx;
-                animation.boneKeys[id] = std::move(boneKeys);
+                animation.channelIndices[*idxNode] = keys.size();
+                keys.push_back(std::move(boneKeys));
             }
 
+            compressAnimation(animation, keys, animationCompression);
+
+            int uncompressedSize = animation.channelIndices.size() * sizeof(int);
+            for(const BoneKeys& boneKeys: keys)
+                uncompressedSize += sizeof(BoneKeys) + getMemorySize(boneKeys);
+
+            log("animation '%s': %d channels, %d -> %d bytes", animation.name.c_str(), int(keys.size()),
+                uncompressedSize, getMemorySize(animation));
+
             skeleton.animations.push_back(std::move(animation));
         }
     }
 
     model.idxMesh = meshes.size();
 
-    Array<float> vertexData;
-    Array<unsigned> indices;
+    // the blocks are recycled by the next models
+    Array<float, PoolAllocator> vertexData;
+    Array<unsigned, PoolAllocator> indices;
 
     for(unsigned idxMesh = 0; idxMesh < scene->mNumMeshes; ++idxMesh)
     {
@@ -1451,7 +3483,19 @@ static void loadModel(const char* filename, std::vector<Model>& models, Array<Me
         const bool hasTexCoords = aimesh.HasTextureCoords(0);
         const bool hasNormals = aimesh.HasNormals();
         const bool hasTangents = aimesh.HasTangentsAndBitangents();
-        const bool hasBones = aimesh.HasBones();
+        const aiNode* const rigidNode = rigidNodes[idxMesh];
+        const bool hasBones = aimesh.HasBones() || rigidNode;
+
+        // the bind pose space of the skinned vertices
+        aiMatrix4x4 bindTransform = scene->mRootNode->mTransformation;
+
+        if(rigidNode)
+        {
+            bindTransform = aiMatrix4x4();
+
+            for(const aiNode* node = rigidNode; node; node = node->mParent)
+                bindTransform = node->mTransformation * bindTransform;
+        }
 
         const int floatsPerVertex = 3 + hasTexCoords * 2 + hasNormals * 3
             + hasTangents * 6 + hasBones * 8;
@@ -1460,17 +3504,20 @@ static void loadModel(const char* filename, std::vector<Model>& models, Array<Me
         vertexData.reserve(aimesh.mNumVertices * floatsPerVertex);
 
         float xmin = 0.f, xmax = 0.f, ymin = 0.f, ymax = 0.f, zmin = 0.f, zmax = 0.f;
+        const int bindVertexOffset = bindVertices.size();
 
         for(unsigned idxVert = 0; idxVert < aimesh.mNumVertices; ++idxVert)
         {
             const aiVector3D v = aimesh.mVertices[idxVert];
+            SkinVertex bindVertex = {};
+            bindVertex.position = {v.x, v.y, v.z};
 
             {
                 aiVector3D tv = v;
 
                 // this should fix bounding boxes for animated models
                 if(hasBones)
-                    tv = scene->mRootNode->mTransformation * v;
+                    tv = bindTransform * v;
 
                 xmin = min(xmin, tv.x);
                 xmax = max(xmax, tv.x);
@@ -1491,6 +3538,7 @@ static void loadModel(const char* filename, std::vector<Model>& models, Array<Me
                 const aiVector3D t = aimesh.mTextureCoords[0][idxVert];
                 vertexData.pushBack(t.x);
                 vertexData.pushBack(t.y);
+                bindVertex.texCoord = {t.x, t.y};
             }
 
             if(hasNormals)
@@ -1499,6 +3547,7 @@ static void loadModel(const char* filename, std::vector<Model>& models, Array<Me
                 vertexData.pushBack(n.x);
                 vertexData.pushBack(n.y);
                 vertexData.pushBack(n.z);
+                bindVertex.normal = {n.x, n.y, n.z};
             }
 
             if(hasTangents)
@@ -1507,6 +3556,7 @@ static void loadModel(const char* filename, std::vector<Model>& models, Array<Me
                 vertexData.pushBack(t.x);
                 vertexData.pushBack(t.y);
                 vertexData.pushBack(t.z);
+                bindVertex.tangent = {t.x, t.y, t.z};
 
                 // we don't want to calculate bitangents in a vertex shader
                 // because it will not work correctly with flipped UVs;
@@ -1515,12 +3565,13 @@ static void loadModel(const char* filename, std::vector<Model>& models, Array<Me
                 vertexData.pushBack(b.x);
                 vertexData.pushBack(b.y);
                 vertexData.pushBack(b.z);
+                bindVertex.bitangent = {b.x, b.y, b.z};
             }
 
             if(hasBones)
             {
                 int count = 0;
-                int bonesIdx[MAX_WEIGHTS];
+                int bonesIdx[MAX_WEIGHTS] = {};
                 float weights[MAX_WEIGHTS] = {};
 
                 for(int idxBone = 0; idxBone < aimesh.mNumBones; ++idxBone)
@@ -1535,7 +3586,7 @@ static void loadModel(const char* filename, std::vector<Model>& models, Array<Me
                         if(aivw.mVertexId == idxVert)
                         {
                             assert(count < MAX_WEIGHTS);
-                            bonesIdx[count] = boneLoadData.at(aiBone.mName.C_Str()).idx;
+                            bonesIdx[count] = idxBone; // into the palette of the mesh
                             weights[count] = aivw.mWeight;
                             ++count;
                             break;
@@ -1543,6 +3594,9 @@ static void loadModel(const char* filename, std::vector<Model>& models, Array<Me
                     }
                 }
 
+                if(rigidNode)
+                    weights[0] = 1.f; // the node, the only bone of the palette
+
                 assert(sizeof(int) == sizeof(float));
 
                 for(int idx: bonesIdx)
@@ -1554,7 +3608,13 @@ static void loadModel(const char* filename, std::vector<Model>& models, Array<Me
 
                 for(float weight: weights)
                     vertexData.pushBack(weight);
+
+                memcpy(bindVertex.boneIds, bonesIdx, sizeof(bonesIdx));
+                memcpy(bindVertex.boneWeights, weights, sizeof(weights));
             }
+
+            if(model.idxSkeleton)
+                bindVertices.pushBack(bindVertex);
         }
 
         indices.clear();
@@ -1570,8 +3630,27 @@ static void loadModel(const char* filename, std::vector<Model>& models, Array<Me
         Mesh& mesh = meshes.back();
         ++model.meshCount;
 
-        mesh.bbox = {{ {xmin, ymin, zmin}, {xmax, ymin, zmin}, {xmin, ymax, zmin}, {xmax, ymax, zmin},
-                       {xmin, ymin, zmax}, {xmax, ymin, zmax}, {xmin, ymax, zmax}, {xmax, ymax, zmax} }};
+        mesh.vertexCount = aimesh.mNumVertices;
+        mesh.bindVertexOffset = bindVertexOffset;
+        mesh.skinnedStart = model.skinnedVertexCount;
+        model.skinnedVertexCount += mesh.vertexCount;
+
+        if(rigidNode)
+        {
+            mesh.paletteStart = model.boneMap.size();
+            mesh.boneCount = 1;
+            model.boneMap.push_back(*rigidBones.find(names.find(rigidNode->mName.C_Str())));
+        }
+        else if(hasBones)
+        {
+            mesh.paletteStart = model.boneMap.size();
+            mesh.boneCount = aimesh.mNumBones;
+
+            for(int idxBone = 0; idxBone < aimesh.mNumBones; ++idxBone)
+                model.boneMap.push_back(boneLoadData.find(names.find(aimesh.mBones[idxBone]->mName.C_Str()))->idx);
+        }
+
+        mesh.bbox = makeBoundingBox({xmin, ymin, zmin}, {xmax, ymax, zmax});
 
         mesh.numIndices = indices.size();
         mesh.idxMaterial = aimesh.mMaterialIndex + materialOffset;
@@ -1652,5 +3731,32 @@ static void loadModel(const char* filename, std::vector<Model>& models, Array<Me
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.bo);
     }
 
+    if(model.idxSkeleton)
+    {
+        Skeleton& skeleton = skeletons[model.idxSkeleton];
+        std::vector<SkinMesh> skinMeshes;
+        const double start = glfwGetTime();
+
+        for(int i = 0; i < model.meshCount; ++i)
+        {
+            const Mesh& mesh = meshes[model.idxMesh + i];
+            skinMeshes.push_back({&bindVertices[mesh.bindVertexOffset], mesh.vertexCount, mesh.paletteStart,
+                                  mesh.boneCount});
+        }
+
+        for(Animation& animation: skeleton.animations)
+            computeAnimationBounds(skeleton, model.boneMap, skinMeshes.data(), skinMeshes.size(), 30.f, animation);
+
+        model.boneCapsules.resize(model.boneMap.size());
+
+        for(const SkinMesh& skinMesh: skinMeshes)
+            fitBoneCapsules(skinMesh, model.boneCapsules.data() + skinMesh.paletteStart);
+
+        for(int i = 0; i < model.meshCount; ++i)
+            model.meshBounds.push_back(meshes[model.idxMesh + i].bbox);
+
+        log("animation bounds: %d clips, %.3f s", int(skeleton.animations.size()), glfwGetTime() - start);
+    }
+
     models.push_back(model);
 }
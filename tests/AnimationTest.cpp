@@ -0,0 +1,212 @@
+// no gl, run with ctest; returns the number of failed checks
+
+#include "../Animation.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static int failures = 0;
+
+#define CHECK(x) \
+    do { if(!(x)) { printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #x); ++failures; } } while(0)
+
+static quat axisAngle(vec3 axis, float angle)
+{
+    const vec3 v = normalize(axis) * sinf(angle * 0.5f);
+    return {v.x, v.y, v.z, cosf(angle * 0.5f)};
+}
+
+// the source keys interpolated the way the runtime does it; this is what the compressed
+// animation has to reproduce
+template<typename K, typename F>
+static auto sampleKeys(const std::vector<K>& keys, float time, F value) -> decltype(value(keys.front()))
+{
+    if(time <= keys.front().timestamp)
+        return value(keys.front());
+
+    for(int i = 0; i < int(keys.size()) - 1; ++i)
+    {
+        if(time < keys[i + 1].timestamp)
+        {
+            const float a = (time - keys[i].timestamp) / (keys[i + 1].timestamp - keys[i].timestamp);
+            return value(keys[i]) * (1.f - a) + value(keys[i + 1]) * a;
+        }
+    }
+
+    return value(keys.back());
+}
+
+static mat4 sampleReference(const BoneKeys& keys, float time)
+{
+    vec3 position(0.f);
+    quat rotation;
+    vec3 scale(1.f);
+
+    if(!keys.positionKeys.empty())
+        position = sampleKeys(keys.positionKeys, time, [](const PositionKey& key) { return key.position; });
+
+    // the test keys are in the same hemisphere, nlerp is the normalized weighted sum
+    if(!keys.rotationKeys.empty())
+    {
+        const vec4 v = sampleKeys(keys.rotationKeys, time, [](const RotationKey& key)
+                                  { return vec4(key.rotation.x, key.rotation.y, key.rotation.z, key.rotation.w); });
+        rotation = normalize(quat{v.x, v.y, v.z, v.w});
+    }
+
+    if(!keys.scaleKeys.empty())
+        scale = sampleKeys(keys.scaleKeys, time, [](const ScaleKey& key) { return key.scale; });
+
+    return composeTRS(position, rotation, scale);
+}
+
+static float getError(const mat4& m1, const mat4& m2)
+{
+    float error = 0.f;
+
+    for(int i = 0; i < 4; ++i)
+    {
+        for(int j = 0; j < 4; ++j)
+            error = max(error, fabsf(m1[i][j] - m2[i][j]));
+    }
+
+    return error;
+}
+
+// channel 0 - irregular keys with different timestamps per track, channel 1 - keys on a line
+// and a constant rotation, channel 2 - no keys at all
+static std::vector<BoneKeys> createKeys()
+{
+    std::vector<BoneKeys> keys(3);
+
+    const float positionTimes[] = {0.f, 0.7f, 1.9f, 2.5f, 3.3f};
+    for(int i = 0; i < 5; ++i)
+        keys[0].positionKeys.push_back({vec3(sinf(i * 1.3f), float(i % 2), i * -0.4f), positionTimes[i]});
+
+    for(int i = 0; i < 4; ++i)
+        keys[0].rotationKeys.push_back({axisAngle(vec3(1.f, float(i), 0.5f), 0.3f + i * 0.25f), i * 1.f});
+
+    keys[0].scaleKeys.push_back({vec3(1.f), 0.f});
+    keys[0].scaleKeys.push_back({vec3(1.5f, 1.f, 0.8f), 3.f});
+
+    for(int i = 0; i < 10; ++i)
+        keys[1].positionKeys.push_back({vec3(i * 0.2f, 1.f, -i * 0.1f), i * 0.3f});
+
+    for(int i = 0; i < 3; ++i)
+        keys[1].rotationKeys.push_back({axisAngle(vec3(0.f, 1.f, 0.f), 1.f), i * 1.5f});
+
+    return keys;
+}
+
+static Animation compress(const std::vector<BoneKeys>& keys, float sampleRate)
+{
+    AnimationCompression settings;
+    settings.sampleRate = sampleRate;
+
+    Animation animation;
+    animation.duration = 3.3f;
+    animation.channelIndices = {0, 1, 2};
+    compressAnimation(animation, keys, settings);
+    return animation;
+}
+
+// maximum error against the source keys over the times, with one cursor per channel as in playback
+static float getMaxError(const Animation& animation, const std::vector<BoneKeys>& keys, const std::vector<float>& times)
+{
+    float error = 0.f;
+    KeyCursor cursors[3];
+
+    for(float time: times)
+    {
+        for(int i = 0; i < 3; ++i)
+            error = max(error, getError(sampleChannel(animation, i, time, cursors[i]), sampleReference(keys[i], time)));
+    }
+
+    return error;
+}
+
+// uniform keys without timestamps; exact at the frames up to the quantization, between them a
+// source key off the frame grid is cut off by at most the change of the slope * frame time / 4
+static void testResampled()
+{
+    const std::vector<BoneKeys> keys = createKeys();
+    const float sampleRate = 24.f;
+    const Animation animation = compress(keys, sampleRate);
+
+    CHECK(animation.sampleRate == sampleRate);
+    CHECK(animation.frameCount == int(ceilf(3.3f * sampleRate)) + 1);
+    CHECK(animation.channels.size() == 3);
+
+    for(const BoneChannel& channel: animation.channels)
+    {
+        CHECK(channel.position.timestamps.empty());
+        CHECK(channel.rotation.timestamps.empty());
+        CHECK(channel.scale.timestamps.empty());
+        CHECK(!channel.sharedTimestamps);
+    }
+
+    // only constant tracks are reduced
+    CHECK(int(animation.channels[0].position.values.size()) == animation.frameCount);
+    CHECK(int(animation.channels[0].rotation.values.size()) == animation.frameCount);
+    CHECK(int(animation.channels[0].scale.values.size()) == animation.frameCount);
+    CHECK(int(animation.channels[1].position.values.size()) == animation.frameCount);
+    CHECK(animation.channels[1].rotation.values.size() == 1);
+    CHECK(animation.channels[2].position.values.size() == 1);
+    CHECK(animation.channels[2].rotation.values.size() == 1);
+    CHECK(animation.channels[2].scale.values.size() == 1);
+
+    std::vector<float> frameTimes;
+    for(int i = 0; i < animation.frameCount; ++i)
+        frameTimes.push_back(i / sampleRate);
+
+    std::vector<float> times;
+    for(int i = 0; i <= 1000; ++i)
+        times.push_back(i * 3.3f / 1000);
+
+    const float frameError = getMaxError(animation, keys, frameTimes);
+    const float error = getMaxError(animation, keys, times);
+    printf("resampled: %d frames, max error %g at the frames, %g between them\n", animation.frameCount, frameError,
+           error);
+
+    CHECK(frameError < 1e-3f);
+    CHECK(error < 5e-2f);
+}
+
+// reduced keys, searched with the cursors; seeks and wrap-around included
+static void testReduced()
+{
+    const std::vector<BoneKeys> keys = createKeys();
+    const Animation animation = compress(keys, 0.f);
+
+    CHECK(animation.sampleRate == 0.f);
+    CHECK(animation.frameCount == 0);
+
+    // the keys on a line reduce to the end points
+    CHECK(animation.channels[1].position.values.size() == 2);
+    CHECK(animation.channels[1].position.timestamps.size() == 2);
+    CHECK(animation.channels[1].rotation.values.size() == 1);
+    CHECK(animation.channels[1].rotation.timestamps.empty());
+
+    std::vector<float> times;
+    for(int i = 0; i <= 1000; ++i)
+        times.push_back(i * 3.3f / 1000);
+
+    // playback loops twice, then random seeks
+    times.insert(times.end(), times.begin(), times.end());
+    for(int i = 0; i < 1000; ++i)
+        times.push_back(rand() * 3.3f / RAND_MAX);
+
+    const float error = getMaxError(animation, keys, times);
+    printf("reduced: max error %g\n", error);
+
+    CHECK(error < 2e-3f);
+}
+
+int main()
+{
+    srand(1);
+    testResampled();
+    testReduced();
+
+    printf("AnimationTest: %d failed checks\n", failures);
+    return failures;
+}
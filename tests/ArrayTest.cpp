@@ -0,0 +1,186 @@
+// no gl, run with ctest; returns the number of failed checks
+
+#include "../Array.hpp"
+
+#include <stdio.h>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK(x) \
+    do { if(!(x)) { printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #x); ++failures; } } while(0)
+
+// multi-byte, so a memmove by elements instead of bytes shows
+struct Element
+{
+    int a;
+    int b;
+    double c;
+};
+
+static bool operator==(const Element& l, const Element& r)
+{
+    return l.a == r.a && l.b == r.b && l.c == r.c;
+}
+
+template<typename A>
+static bool equals(const A& array, const std::vector<Element>& reference)
+{
+    if(array.size() != int(reference.size()))
+        return false;
+
+    for(int i = 0; i < array.size(); ++i)
+    {
+        if(!(array[i] == reference[i]))
+            return false;
+    }
+
+    return true;
+}
+
+// at the front, in the middle and at the end, against std::vector
+template<typename A>
+static void testInsertErase()
+{
+    A array;
+    std::vector<Element> reference;
+
+    for(int i = 0; i < 40; ++i)
+    {
+        const Element element = {i, -i, i * 0.5};
+        const int positions[] = {0, int(reference.size()) / 2, int(reference.size())};
+        const int position = positions[i % 3];
+
+        CHECK(array.insert(position, element) == element);
+        reference.insert(reference.begin() + position, element);
+    }
+
+    CHECK(equals(array, reference));
+
+    while(!reference.empty())
+    {
+        const int positions[] = {0, int(reference.size()) / 2, int(reference.size()) - 1};
+        const int position = positions[reference.size() % 3];
+        const int count = position + 2 <= int(reference.size()) && reference.size() % 2 ? 2 : 1;
+
+        array.erase(position, count);
+        reference.erase(reference.begin() + position, reference.begin() + position + count);
+
+        if(position < int(reference.size()))
+            CHECK(array[position] == reference[position]);
+
+        CHECK(equals(array, reference));
+    }
+}
+
+// the inline storage is used until it is full, the elements move to the heap after that
+static void testSmallArray()
+{
+    SmallArray<Element, 4> array;
+    std::vector<Element> reference;
+    reference.reserve(101);
+    const HeapStats start = getHeapStats();
+
+    for(int i = 0; i < 4; ++i)
+    {
+        array.pushBack({i, i, 0.0});
+        reference.push_back({i, i, 0.0});
+    }
+
+    const char* const object = (const char*)&array;
+    CHECK((const char*)array.data() >= object && (const char*)array.data() < object + sizeof(array));
+    CHECK(getHeapStats().allocations == start.allocations);
+
+    for(int i = 4; i < 100; ++i)
+    {
+        array.pushBack({i, i, 0.0});
+        reference.push_back({i, i, 0.0});
+    }
+
+    CHECK((const char*)array.data() < object || (const char*)array.data() >= object + sizeof(array));
+    CHECK(equals(array, reference));
+
+    array.insert(0, {-1, -1, 0.0});
+    reference.insert(reference.begin(), {-1, -1, 0.0});
+    CHECK(equals(array, reference));
+}
+
+// removed slots are reused, the other indices stay valid
+static void testPool()
+{
+    Pool<Element> pool;
+    const int a = pool.add({1, 1, 1.0});
+    const int b = pool.add({2, 2, 2.0});
+    const int c = pool.add({3, 3, 3.0});
+
+    pool.remove(b);
+    CHECK(!pool.isAlive(b));
+    CHECK(pool.size() == 2);
+
+    const int d = pool.add({4, 4, 4.0});
+    CHECK(d == b);
+    CHECK(pool.isAlive(d));
+    CHECK(pool[a].a == 1 && pool[c].a == 3 && pool[d].a == 4);
+
+    pool.remove(a);
+    pool.remove(c);
+    const int e = pool.add({5, 5, 5.0});
+    const int f = pool.add({6, 6, 6.0});
+    CHECK((e == c && f == a) || (e == a && f == c));
+    CHECK(pool.add({7, 7, 7.0}) == 3);
+    CHECK(pool.maxIndex() == 4);
+    CHECK(pool.size() == 4);
+}
+
+// blocks of a size class go back to the free list of the thread and are reused by an array of
+// another type, without heap calls
+static void testPoolAllocator()
+{
+    const void* block;
+    {
+        Array<float, PoolAllocator> array;
+
+        for(int i = 0; i < 100; ++i)
+            array.pushBack(float(i));
+
+        block = array.data();
+    }
+
+    const HeapStats start = getHeapStats();
+    {
+        Array<int, PoolAllocator> array;
+
+        // grows through the smaller classes to the one of the first array
+        for(int i = 0; i < 100; ++i)
+            array.pushBack(i);
+
+        CHECK(array.data() == block);
+
+        bool valuesKept = true;
+
+        for(int i = 0; i < 100; ++i)
+            valuesKept = valuesKept && array[i] == i;
+
+        CHECK(valuesKept);
+    }
+
+    CHECK(getHeapStats().allocations == start.allocations);
+
+    // the capacity fills the block
+    Array<Element, PoolAllocator> array;
+    array.pushBack({});
+    CHECK(array.capacity() * int(sizeof(Element)) == 64);
+}
+
+int main()
+{
+    testInsertErase<Array<Element>>();
+    testInsertErase<Array<Element, PoolAllocator>>();
+    testInsertErase<SmallArray<Element, 8>>();
+    testSmallArray();
+    testPool();
+    testPoolAllocator();
+
+    printf("ArrayTest: %d failed checks\n", failures);
+    return failures;
+}
@@ -0,0 +1,166 @@
+// no gl, run with ctest; returns the number of failed checks
+
+#include "../HashMap.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK(x) \
+    do { if(!(x)) { printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #x); ++failures; } } while(0)
+
+// the hash is chosen by the test, so the probe sequences cluster at the end of the table and wrap
+struct Key
+{
+    int value;
+    unsigned hash;
+
+    bool operator==(const Key& other) const { return value == other.value; }
+};
+
+static unsigned getHash(const Key& key) { return key.hash; }
+
+template<typename K, typename M>
+static bool equals(HashMap<K, int>& map, const M& reference)
+{
+    if(map.size() != int(reference.size()))
+        return false;
+
+    bool equal = true;
+
+    for(const auto& pair: reference)
+    {
+        const int* value = map.find(pair.first);
+        equal = equal && value && *value == pair.second;
+    }
+
+    int count = 0;
+    map.forEach([&](const K&, int&) { ++count; });
+    return equal && count == map.size();
+}
+
+// random inserts and removes against std::unordered_map, across rehashes; keySpace controls
+// how full the map gets
+static void testRandom(int keySpace, int operationCount)
+{
+    HashMap<int, int> map;
+    std::unordered_map<int, int> reference;
+    bool equal = true;
+
+    for(int i = 0; i < operationCount; ++i)
+    {
+        const int key = rand() % keySpace;
+
+        if(rand() % 3)
+        {
+            bool inserted;
+            map.insert(key, i, &inserted);
+            const bool referenceInserted = reference.insert({key, i}).second;
+            equal = equal && inserted == referenceInserted;
+        }
+        else
+            equal = equal && map.remove(key) == (reference.erase(key) == 1);
+
+        if(i % 97 == 0)
+            equal = equal && equals(map, reference);
+    }
+
+    CHECK(equal);
+    CHECK(equals(map, reference));
+
+    for(const auto& pair: reference)
+        CHECK(map.remove(pair.first));
+
+    CHECK(map.empty());
+    CHECK(!map.find(0));
+}
+
+// every key hashes to one of the last slots of the 16 slot table, the clusters wrap to the front;
+// any removal order has to keep the rest findable
+static void testWrap()
+{
+    for(int round = 0; round < 200; ++round)
+    {
+        HashMap<Key, int> map;
+        std::unordered_map<int, int> reference;
+        std::vector<Key> keys;
+
+        // 11 keys fit in 16 slots without a rehash
+        for(int i = 0; i < 11; ++i)
+        {
+            const Key key = {i, 13u + rand() % 3 + (rand() % 2) * 16};
+            keys.push_back(key);
+            map.insert(key, i);
+            reference[i] = i;
+        }
+
+        while(!keys.empty())
+        {
+            const int idx = rand() % keys.size();
+            CHECK(map.remove(keys[idx]));
+            CHECK(!map.find(keys[idx]));
+            CHECK(!map.remove(keys[idx]));
+            reference.erase(keys[idx].value);
+            keys.erase(keys.begin() + idx);
+
+            bool found = true;
+
+            for(const Key& key: keys)
+            {
+                const int* value = map.find(key);
+                found = found && value && *value == reference[key.value];
+            }
+
+            CHECK(found);
+            CHECK(map.size() == int(keys.size()));
+        }
+    }
+}
+
+// the ids are dense in the order of interning and do not change when the table grows
+static void testStringTable()
+{
+    StringTable table;
+    std::vector<std::string> strings;
+
+    for(int i = 0; i < 1000; ++i)
+    {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "node_%d", i);
+        strings.push_back(buf);
+
+        CHECK(table.find(buf) == -1);
+        CHECK(table.intern(buf) == i);
+    }
+
+    bool stable = true;
+
+    for(int i = 0; i < int(strings.size()); ++i)
+    {
+        stable = stable && table.find(strings[i].c_str()) == i;
+        stable = stable && table.intern(strings[i].c_str()) == i;
+        stable = stable && strings[i] == table.getString(i);
+    }
+
+    CHECK(stable);
+    CHECK(table.size() == 1000);
+    CHECK(table.find("node_1000") == -1);
+    CHECK(table.intern("") == 1000);
+    CHECK(table.find("") == 1000);
+}
+
+int main()
+{
+    srand(1);
+    testRandom(64, 100000); // mostly full, many removes
+    testRandom(5000, 100000); // grows through many rehashes
+    testWrap();
+    testStringTable();
+
+    printf("HashMapTest: %d failed checks\n", failures);
+    return failures;
+}
@@ -0,0 +1,259 @@
+// no gl, run with ctest; returns the number of failed checks
+
+#include "../JobSystem.hpp"
+
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK(x) \
+    do { if(!(x)) { printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #x); ++failures; } } while(0)
+
+static void testParallelFor(JobSystem& jobSystem)
+{
+    const int counts[] = {0, 1, 7, 1000, 100000};
+    const int grainSizes[] = {0, 1, 3, 64, 5000};
+
+    for(int count: counts)
+    {
+        for(int grainSize: grainSizes)
+        {
+            std::vector<std::atomic<int>> hits(count);
+
+            std::atomic<bool> rangesValid(true);
+
+            auto touch = [&](int begin, int end)
+            {
+                if(begin < 0 || end > count || begin >= end || end - begin > (grainSize > 0 ? grainSize : 1))
+                    rangesValid = false;
+
+                for(int i = begin; i < end; ++i)
+                    hits[i].fetch_add(1);
+            };
+
+            jobSystem.parallelFor(count, grainSize, touch);
+
+            int wrong = 0;
+
+            for(std::atomic<int>& hit: hits)
+                wrong += hit.load() != 1;
+
+            CHECK(rangesValid.load());
+            CHECK(wrong == 0);
+        }
+    }
+}
+
+// jobs that wait for other jobs, the waiting threads have to execute them
+static void testNestedWait(JobSystem& jobSystem)
+{
+    const int outerCount = 16;
+    const int innerCount = 1000;
+    std::atomic<int> sum(0);
+
+    auto outer = [&](int begin, int end)
+    {
+        for(int i = begin; i < end; ++i)
+        {
+            auto inner = [&](int innerBegin, int innerEnd) { sum.fetch_add(innerEnd - innerBegin); };
+            jobSystem.parallelFor(innerCount, 10, inner);
+        }
+    };
+
+    jobSystem.parallelFor(outerCount, 1, outer);
+    CHECK(sum.load() == outerCount * innerCount);
+
+    // the same with explicit counters
+    struct Context
+    {
+        JobSystem* jobSystem;
+        std::atomic<int> leaves;
+    } context = {&jobSystem, {0}};
+
+    JobCounter counter;
+
+    for(int i = 0; i < 8; ++i)
+    {
+        jobSystem.run({[](void* ptr, int, int)
+        {
+            Context& context = *(Context*)ptr;
+            JobCounter children;
+
+            for(int k = 0; k < 8; ++k)
+                context.jobSystem->run({[](void* ptr, int, int) { ((Context*)ptr)->leaves.fetch_add(1); }, ptr, 0, 0,
+                                        &children});
+
+            context.jobSystem->wait(children);
+        }, &context, 0, 0, &counter});
+    }
+
+    jobSystem.wait(counter);
+    CHECK(counter.isDone());
+    CHECK(context.leaves.load() == 64);
+}
+
+// jobs are added to a counter while its earlier jobs finish, so it drops to zero and back; the
+// counter lives on the stack and must not be done before its last job
+static void testCounterReuse(JobSystem& jobSystem)
+{
+    struct Context
+    {
+        std::atomic<int> finished;
+        std::atomic<int> background;
+    } context = {{0}, {0}};
+
+    // unrelated jobs completing at the same time
+    JobCounter background;
+
+    for(int i = 0; i < 64; ++i)
+        jobSystem.run({[](void* ptr, int, int) { ((Context*)ptr)->background.fetch_add(1); }, &context, 0, 0,
+                       &background});
+
+    for(int round = 0; round < 2000; ++round)
+    {
+        JobCounter counter;
+        const int jobCount = 1 + round % 16;
+        context.finished = 0;
+
+        for(int i = 0; i < jobCount; ++i)
+            jobSystem.run({[](void* ptr, int, int) { ((Context*)ptr)->finished.fetch_add(1); }, &context, 0, 0,
+                           &counter});
+
+        jobSystem.wait(counter);
+        CHECK(context.finished.load() == jobCount);
+    }
+
+    jobSystem.wait(background);
+    CHECK(context.background.load() == 64);
+}
+
+// an attached thread queues to its own deque while the starting thread runs its own jobs
+static void testExternalThread(JobSystem& jobSystem)
+{
+    const int count = 10000;
+    std::vector<std::atomic<int>> externalHits(count);
+    std::vector<std::atomic<int>> hits(count);
+
+    std::thread external([&]
+    {
+        jobSystem.attachThread(0);
+
+        for(int round = 0; round < 20; ++round)
+        {
+            auto touch = [&](int begin, int end)
+            {
+                for(int i = begin; i < end; ++i)
+                    externalHits[i].fetch_add(1);
+            };
+
+            jobSystem.parallelFor(count, 16, touch);
+        }
+    });
+
+    for(int round = 0; round < 20; ++round)
+    {
+        auto touch = [&](int begin, int end)
+        {
+            for(int i = begin; i < end; ++i)
+                hits[i].fetch_add(1);
+        };
+
+        jobSystem.parallelFor(count, 16, touch);
+    }
+
+    external.join();
+
+    bool allHit = true;
+
+    for(int i = 0; i < count; ++i)
+        allHit = allHit && externalHits[i].load() == 20 && hits[i].load() == 20;
+
+    CHECK(allHit);
+}
+
+// a continuation is queued only after the jobs of its dependency are done
+static void testContinuation(JobSystem& jobSystem)
+{
+    struct Context
+    {
+        std::atomic<int> finished;
+        std::atomic<int> seenByContinuation;
+    } context = {{0}, {-1}};
+
+    const int jobCount = 6;
+    JobCounter dependency;
+    JobCounter done;
+
+    for(int i = 0; i < jobCount; ++i)
+    {
+        jobSystem.run({[](void* ptr, int, int)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            ((Context*)ptr)->finished.fetch_add(1);
+        }, &context, 0, 0, &dependency});
+    }
+
+    jobSystem.run({[](void* ptr, int, int)
+    {
+        Context& context = *(Context*)ptr;
+        context.seenByContinuation = context.finished.load();
+    }, &context, 0, 0, &done}, &dependency);
+
+    CHECK(!done.isDone() || context.finished.load() == jobCount);
+    jobSystem.wait(done);
+    CHECK(context.seenByContinuation.load() == jobCount);
+    jobSystem.wait(dependency);
+
+    // the dependency is already done, the job is queued right away
+    context.seenByContinuation = -1;
+    JobCounter doneAgain;
+
+    jobSystem.run({[](void* ptr, int, int) { ((Context*)ptr)->seenByContinuation = 1; }, &context, 0, 0, &doneAgain},
+                  &dependency);
+
+    jobSystem.wait(doneAgain);
+    CHECK(context.seenByContinuation.load() == 1);
+}
+
+int main()
+{
+    JobSystem jobSystem;
+
+    // not started, the jobs run on the calling thread
+    testParallelFor(jobSystem);
+    testContinuation(jobSystem);
+
+    const int threadCounts[] = {1, 4, 2, 8, 8, 3};
+
+    for(int threadCount: threadCounts)
+    {
+        jobSystem.start(threadCount);
+        CHECK(jobSystem.getThreadCount() == threadCount);
+
+        testParallelFor(jobSystem);
+        testNestedWait(jobSystem);
+        testCounterReuse(jobSystem);
+        testContinuation(jobSystem);
+        testExternalThread(jobSystem); // not reserved, shares the deque of this thread
+
+        jobSystem.start(threadCount, 1);
+        CHECK(jobSystem.getThreadCount() == threadCount);
+        testExternalThread(jobSystem);
+
+        if(threadCount == 2)
+        {
+            jobSystem.stop();
+            CHECK(jobSystem.getThreadCount() == 0);
+        }
+    }
+
+    jobSystem.stop();
+    testParallelFor(jobSystem);
+
+    printf("JobSystemTest: %d failed checks\n", failures);
+    return failures;
+}
@@ -0,0 +1,16 @@
+// no gl, run with ctest; fails if the batched math kernels differ from the scalar code
+
+#include "../Benchmarks.hpp"
+
+#include <stdio.h>
+
+int main()
+{
+    float maxError[3];
+    const bool passed = checkMathKernels(maxError);
+
+    printf("max errors: transform points %g, multiply matrices %g, compose TRS %g\n", maxError[0], maxError[1],
+           maxError[2]);
+
+    return passed ? 0 : 1;
+}